@@ -0,0 +1,21 @@
+#!/bin/sh
+# Generate the synthetic corpus if needed, then open and render each
+# document through the core. Usage: ./bench.sh [updf-bench options]
+#
+# Run from the build tree. CORPUS and SEED pick the files, the output
+# is the updf-bench JSON. BENCH=updf-microbench times the pixel kernels
+# on the same files instead.
+
+CORPUS=${CORPUS:-corpus}
+SEED=${SEED:-1}
+BENCH=${BENCH:-updf-bench}
+
+set -e
+
+if [ ! -f "$CORPUS/.seed-$SEED" ]; then
+	rm -f "$CORPUS"/*.pdf "$CORPUS"/.seed-*
+	src/updf-corpus -o "$CORPUS" -s "$SEED" >/dev/null
+	touch "$CORPUS/.seed-$SEED"
+fi
+
+exec src/$BENCH "$@" "$CORPUS"/*.pdf
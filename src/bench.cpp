@@ -0,0 +1,270 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// updf-bench: render documents through the core, without a display,
+// and report the cost of each step as JSON on stdout.
+
+#include "core.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <locale.h>
+#include <malloc.h>
+
+#define MAX_SWEEP 32
+
+// Have the peak RSS start again from the current one, once the heap of
+// the previous runs is given back
+static void resetpeak() {
+
+  malloc_trim(0);
+
+  static bool warned = false;
+  const int fd = open("/proc/self/clear_refs", O_WRONLY);
+  if ((fd < 0 || write(fd, "5", 1) != 1) && !warned) {
+    err(_("Can't reset the peak RSS, it covers all the runs so far\n"));
+    warned = true;
+  }
+  if (fd >= 0)
+    close(fd);
+}
+
+// Peak RSS since resetpeak(), in kb
+static u64 peakrss() {
+
+  FILE * const f = fopen("/proc/self/status", "r");
+  if (!f)
+    return 0;
+
+  char line[80];
+  unsigned long long kb = 0;
+  while (fgets(line, 80, f)) {
+    if (sscanf(line, "VmHWM: %llu", &kb) == 1)
+      break;
+  }
+  fclose(f);
+
+  return kb;
+}
+
+// Parse "1,2,4" into counts, 0 on a bad list
+static u32 parsesweep(const char *arg, u32 *counts) {
+
+  u32 n = 0;
+  while (*arg && n < MAX_SWEEP) {
+    char *end;
+    const long v = strtol(arg, &end, 10);
+    if (end == arg || v < 1 || v > 256)
+      return 0;
+
+    counts[n++] = v;
+
+    if (*end == ',')
+      end++;
+    else if (*end)
+      return 0;
+    arg = end;
+  }
+
+  return n;
+}
+
+// Powers of two up to the CPU count, and the CPU count itself
+static u32 defaultsweep(u32 *counts) {
+
+  const u32 cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  u32 n = 0, i;
+
+  for (i = 1; i < cpus && n < MAX_SWEEP - 1; i *= 2)
+    counts[n++] = i;
+  counts[n++] = cpus;
+
+  return n;
+}
+
+static bool bench(const char *name, const u32 threads, const bool pages,
+                  const bool first) {
+
+  if (render_threads != threads)
+    core_threads(threads);
+
+  // The previous document goes first, or it would count in this one
+  core_close();
+  resetpeak();
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  int pdferror = 0;
+  const core_status status = core_open(name, &pdferror);
+  if (status != CORE_OK) {
+    if (status == CORE_PDF_ERROR)
+      err(_("%s: PDF error %d\n"), name, pdferror);
+    else
+      err(_("%s: couldn't open\n"), name);
+    return false;
+  }
+
+  core_wait();
+
+  gettimeofday(&end, NULL);
+  const u32 us = usecs(start, end);
+
+  u64 total = 0, totalcomp = 0;
+  u64 render = 0, margins = 0, compress = 0;
+  u32 memory = 0;
+  u32 i;
+  for (i = 0; i < file->pages; i++) {
+    total     += file->cache[i].uncompressed;
+    totalcomp += file->cache[i].size;
+    render    += file->stats[i].render;
+    margins   += file->stats[i].margins;
+    compress  += file->stats[i].compress;
+    if (file->stats[i].memory > memory)
+      memory = file->stats[i].memory;
+  }
+
+  printf("%s  {\"file\": ", first ? "" : ",\n");
+  jsonstr(name);
+  printf(", \"threads\": %u, \"pages\": %u, \"wall_us\": %u, "
+         "\"pages_per_s\": %.2f,\n", threads, file->pages, us,
+         file->pages * 1000000.0f / us);
+  printf("   \"render_us\": %llu, \"margins_us\": %llu, \"compress_us\": %llu,\n",
+         (unsigned long long) render, (unsigned long long) margins,
+         (unsigned long long) compress);
+  printf("   \"bytes\": %llu, \"uncompressed\": %llu, \"ratio\": %.4f, "
+         "\"peak_rss_kb\": %llu, \"page_peak_kb\": %u",
+         (unsigned long long) totalcomp, (unsigned long long) total,
+         total ? totalcomp / (float) total : 0.0f,
+         (unsigned long long) peakrss(), memory);
+
+  if (pages) {
+    printf(",\n   \"page_stats\": [");
+    for (i = 0; i < file->pages; i++) {
+      const cachedpage * const cur = &file->cache[i];
+      const pagestats * const st = &file->stats[i];
+
+      printf("%s\n    {\"page\": %u, \"render_us\": %u, \"margins_us\": %u, "
+             "\"compress_us\": %u, \"bytes\": %u, \"ratio\": %.4f, "
+             "\"peak_kb\": %u}",
+             i ? "," : "", i + 1, st->render, st->margins, st->compress,
+             cur->size,
+             cur->uncompressed ? cur->size / (float) cur->uncompressed : 0.0f,
+             st->memory);
+    }
+    printf("\n   ]");
+  }
+
+  printf("}");
+  fflush(stdout);
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+
+  // Messages only, the numbers must stay JSON
+  #if ENABLE_NLS
+    setlocale(LC_MESSAGES, "");
+    bindtextdomain("updf", LOCALEDIR);
+    textdomain("updf");
+  #endif
+
+  u32 counts[MAX_SWEEP];
+  u32 sweep = 0;
+  bool pages = true;
+
+  const struct option opts[] = {
+    { "summary",    0, NULL, 's' },
+    { "threads",    1, NULL, 't' },
+    { "trace",      1, NULL, 'T' },
+    { "text-layer", 0, NULL, 'x' },
+    { "help",       0, NULL, 'h' },
+    { NULL,         0, NULL,  0  }
+  };
+
+  while (1) {
+    const int c = getopt_long(argc, argv, "hst:T:x", opts, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 's':
+        pages = false;
+      break;
+      case 't':
+        sweep = parsesweep(optarg, counts);
+        if (!sweep)
+          die(_("Bad thread list %s\n"), optarg);
+      break;
+      case 'T':
+        trace_start(optarg);
+      break;
+      case 'x':
+        text_layer = true;
+      break;
+      case 'h':
+      default:
+        printf(_("Usage: %s [options] file.pdf...\n\n"
+          "   -h --help   This help\n"
+          "   -s --summary        Only report the documents, not each page\n"
+          "   -t --threads N,M..  Render with each of these thread counts\n"
+          "                       (default: powers of two up to one per CPU)\n"
+          "   -T --trace FILE     Write the spans of each page to FILE\n"
+          "                       as a Chrome trace\n"
+          "   -x --text-layer     Extract the text while rendering\n"),
+          argv[0]);
+        return 0;
+      break;
+    }
+  }
+
+  if (optind >= argc)
+    die(_("No document given, see %s --help\n"), argv[0]);
+
+  if (!sweep)
+    sweep = defaultsweep(counts);
+
+  // Only the page pipeline is measured
+  text_index = false;
+  page_stats = true;
+
+  render_threads = counts[0];
+  core_init();
+
+  printf("{\"runs\": [\n");
+
+  bool first = true;
+  u32 failed = 0, t;
+  int i;
+  for (t = 0; t < sweep; t++) {
+    for (i = optind; i < argc; i++) {
+      if (bench(argv[i], counts[t], pages, first))
+        first = false;
+      else
+        failed++;
+    }
+  }
+
+  core_close();
+
+  printf("\n]}\n");
+
+  if (tracing)
+    trace_dump();
+
+  return failed ? 1 : 0;
+}
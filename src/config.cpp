@@ -149,6 +149,33 @@ bool file_exists (const char * name) {
   return (stat (name, &buffer) == 0); 
 }
 
+// The files are not checked when the config is read, to keep a stat()
+// per recent file out of the startup. Drop the ones gone since.
+void prune_recent_files() {
+
+  recent_file_struct *prev = NULL;
+  recent_file_struct *rf   = recent_files;
+
+  while (rf != NULL) {
+    recent_file_struct * const next = rf->next;
+
+    if (file_exists(rf->filename.c_str())) {
+      prev = rf;
+    }
+    else {
+      if (prev)
+        prev->next = next;
+      else
+        recent_files = next;
+
+      clear_singles(rf->my_trim);
+      delete rf;
+    }
+
+    rf = next;
+  }
+}
+
 void load_config() {
 
   Config cfg;
@@ -192,8 +219,8 @@ void load_config() {
 
       Setting &s = rf_setting[i];
       std::string filename = s["filename"];
-      
-      if (file_exists(filename.c_str())) {
+
+      if (!filename.empty()) {
         recent_file_struct *rf = new recent_file_struct;
 
         rf->title_page_count = 0;
@@ -326,6 +353,8 @@ void save_config() {
   strncpy(config_filename, homedir, 300);
   strncat(config_filename, "/.updf", 300 - strlen(config_filename) - 1);
 
+  prune_recent_files();
+
   try {
     Setting &root = cfg.getRoot();
     if (root.exists("recent_files"))
@@ -0,0 +1,1268 @@
+/*
+Copyright (C) 2015 Lauri Kasanen
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Modifications Copyright (C) 2016 Guy Turcotte
+*/
+
+#include "core.h"
+#include "procrender.h"
+#include "notify.h"
+#include "textcache.h"
+#include "search.h"
+#include "scan.h"
+#include "wordgrid.h"
+#include "teedev.h"
+#include "trace.h"
+#include "textstore.h"
+#include "watch.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <GlobalParams.h>
+#include <SplashOutputDev.h>
+#include <TextOutputDev.h>
+#include <splash/SplashBitmap.h>
+
+u8         details   = 0;
+int        writepipe = -1;
+openfile * file      = NULL;
+
+u32 render_processes = 0;
+u32 render_threads   = 0;
+s32 render_nice      = POOL_NICE;
+bool text_layer      = false;
+bool text_index      = true;
+bool page_stats      = false;
+bool assume_remote   = false;
+bool live_reload     = false;
+
+threadpool * pool = NULL;
+
+void getmargins(const u8 * const src, const u32 w, const u32 h,
+      const u32 rowsize, u32 *minx, u32 *maxx,
+      u32 *miny, u32 *maxy) {
+
+  int i, j;
+
+  bool found = false;
+  for (i = 0; i < (int) w && !found; i++) {
+    for (j = 0; j < (int) h && !found; j++) {
+      const u8 * const pixel = src + j * rowsize + i * 4;
+      if (nonwhite(pixel)) {
+        found = true;
+        *minx = i;
+      }
+    }
+  }
+
+  found = false;
+  for (j = 0; j < (int) h && !found; j++) {
+    for (i = *minx; i < (int) w && !found; i++) {
+      const u8 * const pixel = src + j * rowsize + i * 4;
+      if (nonwhite(pixel)) {
+        found = true;
+        *miny = j;
+      }
+    }
+  }
+
+  const int startx = *minx, starty = *miny;
+
+  found = false;
+  for (i = w - 1; i >= startx && !found; i--) {
+    for (j = h - 1; j >= starty && !found; j--) {
+      const u8 * const pixel = src + j * rowsize + i * 4;
+      if (nonwhite(pixel)) {
+        found = true;
+        *maxx = i;
+      }
+    }
+  }
+
+  found = false;
+  for (j = h - 1; j >= starty && !found; j--) {
+    for (i = *maxx; i >= startx && !found; i--) {
+      const u8 * const pixel = src + j * rowsize + i * 4;
+      if (nonwhite(pixel)) {
+        found = true;
+        *maxy = j;
+      }
+    }
+  }
+}
+
+// Copy the w x h box at x, y out of the bitmap, rows packed
+u8 *trimcopy(const u8 * const src, const u32 rowsize, const u32 x, const u32 y,
+             const u32 w, const u32 h) {
+
+  u8 * const trimmed = (u8 *) xcalloc(w * h * 4, 1);
+  u32 j;
+  for (j = 0; j < h; j++) {
+    memcpy(trimmed + j * w * 4, src + (j + y) * rowsize + x * 4, w * 4);
+  }
+
+  return trimmed;
+}
+
+// LZO compress len bytes into a buffer of just the needed size
+u8 *compresspage(const u8 * const src, const u32 len, u32 * const outlen) {
+
+  u8 * const tmp = (u8 *) xcalloc(len * 1.08f, 1);
+  u8 workmem[LZO1X_1_MEM_COMPRESS]; // 64kb, we can afford it
+  lzo_uint size;
+  int ret = lzo1x_1_compress(src, len, tmp, &size, workmem);
+  if (ret != LZO_E_OK)
+    die(_("Compression failed\n"));
+
+  u8 * const dst = (u8 *) xcalloc(size, 1);
+  memcpy(dst, tmp, size);
+  free(tmp);
+
+  *outlen = size;
+  return dst;
+}
+
+// Trim and compress a bitmap of the page into out. The time of each step
+// goes to stats, when given.
+void store(const u8 * const src, const u32 w, const u32 h,
+      const u32 rowsize, cachedpage * const out, const u32 page,
+      pagestats * const stats) {
+
+  u32 minx = 0, miny = 0, maxx = w - 1, maxy = h - 1;
+
+  struct timeval start, end;
+  if (stats)
+    gettimeofday(&start, NULL);
+
+  u64 span = trace_begin();
+
+  // Trim margins
+  getmargins(src, w, h, rowsize, &minx, &maxx, &miny, &maxy);
+
+  trace_end(TR_MARGINS, span, page);
+  span = trace_begin();
+
+  if (stats) {
+    gettimeofday(&end, NULL);
+    stats->margins = usecs(start, end);
+    start = end;
+  }
+
+  const u32 trimw = maxx - minx + 1;
+  const u32 trimh = maxy - miny + 1;
+
+  u8 * const trimmed = trimcopy(src, rowsize, minx, miny, trimw, trimh);
+
+  u32 outlen;
+  u8 * const dst = compresspage(trimmed, trimw * trimh * 4, &outlen);
+  free(trimmed);
+
+  trace_end(TR_COMPRESS, span, page);
+
+  if (stats) {
+    gettimeofday(&end, NULL);
+    stats->compress = usecs(start, end);
+
+    const u64 trimsize = (u64) trimw * trimh * 4;
+    stats->memory = ((u64) rowsize * h + trimsize + (u64) (trimsize * 1.08f) +
+                     outlen) / 1024;
+  }
+
+  // Store
+  out->uncompressed = trimw * trimh * 4;
+  out->w = trimw;
+  out->h = trimh;
+  out->left = minx;
+  out->right = w - maxx;
+  out->top = miny;
+  out->bottom = h -maxy;
+
+  out->size = outlen;
+  out->data = dst;
+}
+
+// Filesystems where each fault in a mapping is a round trip to a server
+static bool remotefs(const int fd) {
+
+  struct statfs fs;
+  if (fstatfs(fd, &fs))
+    return false;
+
+  switch ((u32) fs.f_type) {
+    case 0x6969:      // NFS
+    case 0x517b:      // SMB
+    case 0xff534d42:  // CIFS
+    case 0xfe534d42:  // SMB2
+    case 0x65735546:  // FUSE, sshfs and the like
+    case 0x01021997:  // 9p
+      return true;
+  }
+
+  return false;
+}
+
+// Read the whole file in one sequential pass
+static u8 *slurp(const int fd, const u64 size) {
+
+  u8 * const data = (u8 *) malloc(size);
+  if (!data)
+    return NULL;
+
+  u64 done = 0;
+  while (done < size) {
+    const ssize_t ret = read(fd, data + done, size - done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      free(data);
+      return NULL;
+    }
+    done += ret;
+  }
+
+  return data;
+}
+
+// A linearized file starts with a dictionary giving where the part
+// holding the first page ends, /E, and where the main cross-reference
+// table starts, /T. Poppler then reads that page from these two parts
+// alone. 0 if not linearized, or appended to since, /L.
+static u64 firstpart(const int fd, const u64 size, u64 * const mainxref) {
+
+  char head[1024];
+  const ssize_t len = pread(fd, head, sizeof(head), 0);
+  if (len <= 0)
+    return 0;
+
+  const char * const dict = (const char *) memmem(head, len, "/Linearized", 11);
+  if (!dict)
+    return 0;
+  const char * const end = (const char *) memmem(dict, head + len - dict, ">>", 2);
+  if (!end)
+    return 0;
+
+  u64 length = 0, first = 0, xref = 0;
+  const char *p;
+  for (p = dict; p + 2 < end; p++) {
+    if (p[0] != '/' || isalpha(p[2]))
+      continue;
+    if (p[1] == 'L')
+      length = strtoull(p + 2, NULL, 10);
+    else if (p[1] == 'E')
+      first = strtoull(p + 2, NULL, 10);
+    else if (p[1] == 'T')
+      xref = strtoull(p + 2, NULL, 10);
+  }
+
+  if (length != size || !first || first >= size || xref < first || xref >= size)
+    return 0;
+
+  *mainxref = xref;
+  return first;
+}
+
+// Read from..to of the file into the same place of data. Between reads,
+// gives up when the document is being closed.
+static bool readpart(const int fd, u8 * const data, u64 from, const u64 to,
+                     const std::atomic<bool> * const abort) {
+
+  while (from < to) {
+    if (abort && abort->load(std::memory_order_acquire))
+      return false;
+
+    const u64 len = to - from < 1024 * 1024 ? to - from : 1024 * 1024;
+    const ssize_t ret = pread(fd, data + from, len, from);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return false;
+    from += ret;
+  }
+
+  return true;
+}
+
+static void input_free(u8 * const data, const u64 size, const bool mapped) {
+
+  if (mapped)
+    munmap(data, size);
+  else
+    free(data);
+}
+
+// Bytes fetched from storage and major faults of this process so far
+static void iocounters(u64 *bytes, u64 *faults) {
+
+  *bytes = 0;
+  FILE * const f = fopen("/proc/self/io", "r");
+  if (f) {
+    char line[80];
+    unsigned long long v;
+    while (fgets(line, 80, f)) {
+      if (sscanf(line, "read_bytes: %llu", &v) == 1)
+        *bytes = v;
+    }
+    fclose(f);
+  }
+
+  struct rusage ru;
+  *faults = getrusage(RUSAGE_SELF, &ru) ? 0 : ru.ru_majflt;
+}
+
+PDFDoc *memdoc(const u8 * const data, const u64 size) {
+
+  // The stream does not own the buffer, it stays in memory as long
+  // as the file is opened.
+#if POPPLER_OBJECT_RVALUE
+  MemStream *str = new MemStream((char *) data, 0, size, Object(objNull));
+#else
+  Object obj;
+  obj.initNull();
+  MemStream *str = new MemStream((char *) data, 0, size, &obj);
+#endif
+
+  return new PDFDoc(str);
+}
+
+static void load_wait();
+
+// The thread that called core_init(), the only one besides the pool
+// that may render, with the main PDFDoc
+static pthread_t uithread;
+
+// Retrieve the PDFDoc private to the calling render thread, opening it
+// on first use. Only the owning thread touches its slot. Outside of the
+// pool, this must be the UI thread and it uses the main one: a PDFDoc
+// can't be shared by two threads.
+PDFDoc *workerdoc() {
+
+  const s32 tid = threadpool::worker_id();
+  if (tid < 0) {
+    if (!pthread_equal(pthread_self(), uithread))
+      die(_("A page was rendered outside of the render and UI threads\n"));
+    load_wait();
+    return file->pdf;
+  }
+
+  // Until the whole file is there, see loadrest()
+  wait_loaded();
+
+  if (!file->workers[tid]) {
+    PDFDoc * const pdf = memdoc(file->data, file->size);
+    if (!pdf->isOk())
+      die(_("Render thread %d failed to open the document\n"), tid);
+    file->workers[tid] = pdf;
+  }
+
+  return file->workers[tid];
+}
+
+// Rasterize a page and store its trimmed, compressed bitmap into out.
+// With withtext, the text layer is built from the same interpretation
+// of the page. The caller owns out->data and out->text.
+void renderpage(PDFDoc * const pdf, const u32 page, cachedpage * const out,
+                const bool withtext) {
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  const u64 span = trace_begin();
+
+  SplashColor white = { 255, 255, 255 };
+  SplashOutputDev *splash = new SplashOutputDev(splashModeXBGR8, 4, false, white);
+  splash->startDoc(pdf);
+
+  if (withtext) {
+    TextOutputDev text(NULL, true, 0, false, false);
+    TeeOutputDev tee(splash, &text);
+
+    pdf->displayPage(&tee, page + 1, RENDER_DPI, RENDER_DPI, 0, true, false, false);
+
+    TextPage * const words = text.takeText();
+    out->text = textlayer_build(words);
+    words->decRefCnt();
+  } else {
+    pdf->displayPage(splash, page + 1, RENDER_DPI, RENDER_DPI, 0, true, false, false);
+  }
+
+  trace_end(TR_RENDER, span, page);
+
+  pagestats * const stats = file->stats ? &file->stats[page] : NULL;
+
+  gettimeofday(&end, NULL);
+  if (stats)
+    stats->render = usecs(start, end);
+  if (details > 1) {
+    printf("%u: rendering %u us\n", page, usecs(start, end));
+    start = end;
+  }
+
+  SplashBitmap * const bm = splash->takeBitmap();
+
+  store(bm->getDataPtr(), bm->getWidth(), bm->getHeight(), bm->getRowSize(), out,
+        page, stats);
+
+  gettimeofday(&end, NULL);
+  if (details > 1) {
+    printf("%u: storing %u us\n", page, usecs(start, end));
+    start = end;
+  }
+
+  delete bm;
+  delete splash;
+}
+
+// Store a white page the size of the first one, for pages that
+// could not be rendered.
+void blankpage(const u32 page) {
+
+  const cachedpage * const ref = &file->cache[0];
+  const u32 w = ref->w + ref->left + ref->right;
+  const u32 h = ref->h + ref->top + ref->bottom;
+
+  u8 * const white = (u8 *) xmalloc(w * h * 4);
+  memset(white, 255, w * h * 4);
+
+  store(white, w, h, w * 4, &file->cache[page], page, NULL);
+
+  free(white);
+}
+
+// The page content is stored, make it visible to the other threads
+void pageready(const u32 page) {
+
+  file->cache[page].state.store(PAGE_READY, std::memory_order_release);
+
+  file->stored.fetch_add(file->cache[page].size, std::memory_order_relaxed);
+  file->ready.fetch_add(1, std::memory_order_relaxed);
+
+  // The app decides if it was visible
+  notify_page(page);
+}
+
+static void dopage(const u32 page) {
+
+  renderpage(workerdoc(), page, &file->cache[page], text_layer);
+  pageready(page);
+}
+
+// Set by the UI while it cancels the tasks of the opened document, the
+// worker processes loop checks it between pages
+static std::atomic<bool> aborting(false);
+
+// Identifies the document the pool tasks work for
+static u32 documents = 0;
+
+// A new version of the file, being compared with the opened one
+struct reloadfile {
+  PDFDoc    * pdf;
+  u8        * data;
+  u64         size;
+  u64         inode, mtime;
+  u32         pages;
+  u32         doc;
+  u64       * prints;
+  PDFDoc   ** workers;    // Per render thread, as openfile.workers
+  std::atomic<u32> pending;   // Pages left to fingerprint
+};
+
+static reloadfile * reloading = NULL;
+
+// All pages are there, print stats and tell the app
+static void finished() {
+
+  // Print stats
+  if (details) {
+    struct timeval end;
+    u32 total = 0, totalcomp = 0;
+    for (u32 i = 0; i < file->pages; i++) {
+      total += file->cache[i].uncompressed;
+      totalcomp += file->cache[i].size;
+    }
+
+    printf(_("Compressed mem usage %.2fmb, compressed to %.2f%%\n"),
+      totalcomp / 1024 / 1024.0f, 100 * totalcomp / (float) total);
+
+    gettimeofday(&end, NULL);
+    const u32 us = usecs(file->started, end);
+
+    printf(_("Processing the file took %u us (%.2f s)\n"), us,
+      us / 1000000.0f);
+
+    // Run with --threads 1..N to get the scaling curve
+    printf(_("Rendered %u pages with %u threads: %.2f pages/s\n"),
+      file->pages, file->worker_count, file->pages * 1000000.0f / us);
+
+    // Of this process, the worker processes are not counted
+    u64 bytes, faults;
+    iocounters(&bytes, &faults);
+    printf(_("Rendering read %.2f MB from storage, %llu major faults\n"),
+      (bytes - file->iobytes) / 1024 / 1024.0f,
+      (unsigned long long) (faults - file->iofaults));
+  }
+
+  u32 maxw = 0, maxh = 0;
+  for (u32 i = 0; i < file->pages; i++) {
+    if (file->cache[i].w > maxw)
+      maxw = file->cache[i].w;
+    if (file->cache[i].h > maxh)
+      maxh = file->cache[i].h;
+  }
+  file->maxw = maxw;
+  file->maxh = maxh;
+
+  file->complete = true;
+
+  // Set normal cursor
+  core_message(MSG_READY);
+}
+
+// Render a page claimed by the caller and count it
+static void renderclaimed(const u32 page) {
+
+  dopage(page);
+
+  if (file->rendered.fetch_add(1) + 1 == file->pages)
+    finished();
+}
+
+static void rendertask(void *arg) {
+
+  const u32 page = (uintptr_t) arg;
+
+  // Already rendered, or being rendered by an urgent request
+  if (!claim_page(page))
+    return;
+
+  renderclaimed(page);
+}
+
+// Fingerprint a page of the opened document, for the next reload
+static void printtask(void *arg) {
+
+  const u32 page = (uintptr_t) arg;
+  file->prints[page] = pdf_fingerprint(workerdoc(), page);
+}
+
+// Fingerprint a page of the reloaded document, and hand it to the UI
+// once they are all done
+static void reprinttask(void *arg) {
+
+  const u32 page = (uintptr_t) arg;
+  const s32 tid = threadpool::worker_id();
+
+  if (!reloading->workers[tid]) {
+    PDFDoc * const pdf = memdoc(reloading->data, reloading->size);
+    if (!pdf->isOk())
+      die(_("Render thread %d failed to open the document\n"), tid);
+    reloading->workers[tid] = pdf;
+  }
+
+  reloading->prints[page] = pdf_fingerprint(reloading->workers[tid], page);
+
+  if (reloading->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    core_message(MSG_RELOADED);
+}
+
+static void proctask(void *) {
+
+  if (!procrender(render_processes, &aborting, dopage)) {
+    // Couldn't start the workers, use the threads
+    u32 i;
+    for (i = 1; i < file->pages; i++)
+      pool->submit(rendertask, (void *) (uintptr_t) i, file->doc);
+    return;
+  }
+
+  if (!aborting.load(std::memory_order_acquire))
+    finished();
+}
+
+// The user is looking at these pages, render them before the others
+void render_visible(const u32 first, const u32 last) {
+
+  // Until the whole file is read, loadrest() starts from first_visible
+  if (!file->cache || render_processes || first == file->hinted ||
+      file->partial.load(std::memory_order_acquire))
+    return;
+
+  file->hinted = first;
+
+  // Each one goes at the front of the urgent queue, the first page last
+  u32 i;
+  for (i = last + 1; i-- > first; ) {
+    if (file->cache[i].state.load(std::memory_order_relaxed) == PAGE_UNRENDERED)
+      pool->submit(rendertask, (void *) (uintptr_t) i, file->doc, true);
+  }
+}
+
+// Queue the pages left after the first, from the view on
+static void queue_rest() {
+
+  if (render_processes) {
+    pool->submit(proctask, NULL, file->doc);
+    return;
+  }
+
+  // The pages before the view last
+  const u32 from = file->first_visible.load(std::memory_order_relaxed);
+  u32 i;
+  for (i = 1; i < file->pages; i++)
+    pool->submit(rendertask, (void *) (uintptr_t) ((from + i) % file->pages),
+                 file->doc);
+}
+
+// A linearized file on a network filesystem opens once its first page
+// part and its cross-reference tables are read. This thread reads the
+// part between them, then has the other pages rendered.
+static pthread_t  loader;
+static bool       loading    = false;
+static int        loader_fd  = -1;
+static u64        loader_from, loader_to;
+static PDFDoc   * loaded_pdf = NULL;   // Over the whole file, for the UI
+
+static void *loadrest(void *) {
+
+  const bool ok = readpart(loader_fd, file->data, loader_from, loader_to,
+                           &aborting);
+  close(loader_fd);
+  loader_fd = -1;
+
+  if (aborting.load(std::memory_order_acquire))
+    return NULL;
+
+  if (ok) {
+    loaded_pdf = memdoc(file->data, file->size);
+    if (!loaded_pdf->isOk()) {
+      delete loaded_pdf;
+      loaded_pdf = NULL;
+    }
+  }
+
+  // Nothing can render from the part read, show what's missing blank
+  if (!loaded_pdf) {
+    err(_("Failed to read %s, its pages are left blank\n"), file->filename);
+
+    u32 i;
+    for (i = 1; i < file->pages; i++) {
+      if (!claim_page(i))
+        continue;
+      blankpage(i);
+      pageready(i);
+      if (file->rendered.fetch_add(1) + 1 == file->pages)
+        finished();
+    }
+  }
+
+  // The render threads may open their PDFDoc now
+  file->partial.store(false, std::memory_order_release);
+
+  if (!loaded_pdf)
+    return NULL;
+
+  if (details)
+    printf(_("Read the rest of the document in the background\n"));
+
+  // Nothing else renders until then, the UI waits in load_wait()
+  if (file->rendered.load() == file->pages)
+    finished();
+  else
+    queue_rest();
+
+  return NULL;
+}
+
+// Wait for the loader, and give the UI the PDFDoc over the whole file
+static void load_wait() {
+
+  if (!loading)
+    return;
+
+  pthread_join(loader, NULL);
+  loading = false;
+
+  if (loaded_pdf) {
+    delete file->pdf;
+    file->pdf = loaded_pdf;
+    loaded_pdf = NULL;
+  }
+}
+
+// The compressor, once per process. procrender_init() calls it before
+// forking, so that the worker processes inherit it.
+void compress_init() {
+
+  static bool done = false;
+  if (done)
+    return;
+
+  if (lzo_init() != LZO_E_OK)
+    die(_("LZO init failed\n"));
+  done = true;
+}
+
+// Start the render threads, render_threads is set by then
+void core_init() {
+
+  compress_init();
+  uithread = pthread_self();
+
+  if (!render_threads)
+    render_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  pool = new threadpool(render_threads, render_nice);
+
+  file = new openfile();
+
+  if (!globalParams)
+    globalParams = new GlobalParams;
+}
+
+// Replace the render pool by one of the given size, between documents
+void core_threads(const u32 threads) {
+
+  core_close();
+
+  delete pool;
+  render_threads = threads;
+  pool = new threadpool(render_threads, render_nice);
+}
+
+void core_message(const u8 msg) {
+
+  if (writepipe >= 0)
+    swrite(writepipe, &msg, 1);
+}
+
+// Drop the reload in progress, if any
+static void reload_cancel() {
+
+  if (!reloading)
+    return;
+
+  pool->cancel(reloading->doc);
+
+  u32 i;
+  for (i = 0; i < file->worker_count; i++)
+    delete reloading->workers[i];
+  free(reloading->workers);
+  delete reloading->pdf;
+  free(reloading->data);
+  free(reloading->prints);
+
+  delete reloading;
+  reloading = NULL;
+}
+
+// Stop the tasks of the opened document and free all of it
+void core_close() {
+
+  reload_cancel();
+
+  if (file->cache) {
+    aborting.store(true, std::memory_order_release);
+    load_wait();
+    pool->cancel(file->doc);
+    aborting.store(false, std::memory_order_release);
+
+    scan_stop();
+    wordgrid_clear();
+    text_cache_clear();
+    index_clear();
+
+    u32 i;
+    const u32 max = file->pages;
+    for (i = 0; i < max; i++) {
+      const u8 * const data = file->cache[i].data;
+      const bool inarena = file->arena && data >= file->arena &&
+                           data < file->arena + file->arena_size;
+      if (!inarena)
+        free(file->cache[i].data);
+      free(file->cache[i].text);
+    }
+    delete [] file->cache;
+    file->cache = NULL;
+  }
+
+  free(file->stats);
+  file->stats = NULL;
+  free(file->prints);
+  file->prints = NULL;
+
+  if (file->arena) {
+    munmap(file->arena, file->arena_size);
+    file->arena = NULL;
+  }
+
+  if (file->workers) {
+    u32 i;
+    for (i = 0; i < file->worker_count; i++)
+      delete file->workers[i];
+    free(file->workers);
+    file->workers = NULL;
+  }
+
+  // The PDFDocs read from it until deleted
+  if (file->pdf) delete file->pdf;
+  if (file->data) input_free(file->data, file->size, file->mapped);
+  if (file->filename) free(file->filename);
+  file->data = NULL;
+  file->filename = NULL;
+  file->pdf = NULL;
+  file->pages = 0;
+}
+
+// Open a document in place of the current one, and start rendering it.
+// The first page is ready on return. On CORE_PDF_ERROR, pdferror gets
+// poppler's error code.
+// first and last are the pages the view will show, when known, so they
+// render ahead of the others.
+core_status core_open(const char *filename, int *pdferror, const u32 first,
+                      const u32 last) {
+
+  const u64 span = trace_begin();
+
+  // Bring the whole document in memory, to be shared by the main
+  // PDFDoc and the render threads
+  const int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) || st.st_size < 1) {
+    if (fd >= 0) close(fd);
+    return CORE_OPEN_FAILED;
+  }
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  u64 iobytes, iofaults;
+  iocounters(&iobytes, &iofaults);
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  // On a network filesystem, the threads would fault the mapping in
+  // with small random reads. Read it once instead. When it's linearized,
+  // only the first page part and the cross-reference tables are read
+  // before the first page is shown, loadrest() reads the rest.
+  // Locally, the first part of a linearized file is only read ahead.
+  // A live reloaded file gets its own copy, the build writes over it.
+  const bool remote = assume_remote || remotefs(fd);
+  u64 mainxref = 0;
+  const u64 firstend = firstpart(fd, st.st_size, &mainxref);
+  const bool mapped = !live_reload && !remote;
+  bool partial = !live_reload && remote && firstend;
+
+  // The main table is preceded by its header or stream dictionary
+  const u64 tail = mainxref - firstend > 65536 ? mainxref - 65536 : firstend;
+
+  u8 *data;
+  if (mapped) {
+    const u64 ahead = firstend ? firstend : st.st_size;
+    posix_fadvise(fd, 0, ahead, POSIX_FADV_WILLNEED);
+    data = (u8 *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+      data = NULL;
+    else
+      madvise(data, ahead, MADV_WILLNEED);
+  }
+  else if (partial) {
+    data = (u8 *) calloc(st.st_size, 1);
+    if (data && (!readpart(fd, data, 0, firstend, NULL) ||
+                 !readpart(fd, data, tail, st.st_size, NULL))) {
+      free(data);
+      data = NULL;
+    }
+  }
+  else {
+    data = slurp(fd, st.st_size);
+  }
+  if (!data) {
+    close(fd);
+    return CORE_MAP_FAILED;
+  }
+
+  // Parse info
+  PDFDoc *pdf = memdoc(data, st.st_size);
+
+  // Not laid out as it says, it needs the whole file
+  if (partial && !pdf->isOk()) {
+    partial = false;
+    delete pdf;
+    if (!readpart(fd, data, firstend, tail, NULL)) {
+      free(data);
+      close(fd);
+      return CORE_MAP_FAILED;
+    }
+    pdf = memdoc(data, st.st_size);
+  }
+
+  if (!partial)
+    close(fd);
+
+  if (!pdf->isOk()) {
+    if (pdferror)
+      *pdferror = pdf->getErrorCode();
+
+    delete pdf;
+    input_free(data, st.st_size, mapped);
+    return CORE_PDF_ERROR;
+  }
+
+  if (details) {
+    u64 bytes, faults;
+    iocounters(&bytes, &faults);
+    gettimeofday(&end, NULL);
+
+    printf(_("%s %.2f MB in %u us, %.2f MB read from storage, %llu major faults\n"),
+      mapped ? _("Mapped") : _("Read"), st.st_size / 1024 / 1024.0f,
+      usecs(start, end), (bytes - iobytes) / 1024 / 1024.0f,
+      (unsigned long long) (faults - iofaults));
+    if (partial)
+      printf(_("Linearized, read the first page part, %.2f MB, and the "
+               "cross-reference tables, %.2f MB\n"),
+        firstend / 1024 / 1024.0f, (st.st_size - tail) / 1024 / 1024.0f);
+    else if (firstend)
+      printf(_("Linearized, the first page is in the first %.2f MB\n"),
+        firstend / 1024 / 1024.0f);
+  }
+
+  core_close();
+
+  file->filename = (char *) xmalloc(strlen(filename) + 1);
+  strcpy(file->filename, filename);
+  file->pdf = pdf;
+  file->data = data;
+  file->size = st.st_size;
+  file->mapped = mapped;
+  file->inode = st.st_ino;
+  file->mtime = (u64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  file->worker_count = pool->threads();
+  file->workers = (PDFDoc **) xcalloc(file->worker_count, sizeof(PDFDoc *));
+  file->pages = pdf->getNumPages();
+  file->maxw = file->maxh = 0;
+  file->first_visible = file->last_visible = 0;
+  file->doc = ++documents;
+  file->hinted = 0;
+  file->rendered = 0;
+  file->ready = 0;
+  file->stored = 0;
+  file->complete = false;
+  file->partial = partial;
+
+  // Start threaded magic
+  if (file->pages < 1) {
+    if (partial)
+      close(fd);
+    file->partial = false;
+    return CORE_NO_PAGES;
+  }
+
+  file->cache = new cachedpage[file->pages]();
+  if (page_stats)
+    file->stats = (pagestats *) xcalloc(file->pages, sizeof(pagestats));
+
+  gettimeofday(&file->started, NULL);
+  iocounters(&file->iobytes, &file->iofaults);
+
+  // The first page is needed right away for the layout. A restored view
+  // further in renders on the pool meanwhile.
+  file->cache[0].state = PAGE_RENDERING;
+
+  const u32 from = first < file->pages ? first : file->pages - 1;
+  if (from) {
+    file->first_visible = from;
+    file->last_visible = last < from ? from :
+                         last < file->pages ? last : file->pages - 1;
+    render_visible(file->first_visible, file->last_visible);
+  }
+
+  renderpage(pdf, 0, &file->cache[0], text_layer);
+  pageready(0);
+
+  // Have the kernel read the rest in while the other pages render
+  if (mapped && firstend) {
+    const u64 rest = firstend & ~((u64) getpagesize() - 1);
+    madvise(data + rest, st.st_size - rest, MADV_WILLNEED);
+  }
+
+  trace_end(TR_OPEN, span, 0);
+
+  // The visible pages may all be done already
+  const bool done = file->rendered.fetch_add(1) + 1 == file->pages;
+
+  if (partial) {
+    loader_fd = fd;
+    loader_from = firstend;
+    loader_to = tail;
+    if (pthread_create(&loader, NULL, loadrest, NULL))
+      die(_("Failed to create a thread\n"));
+    loading = true;
+  }
+  else if (done) {
+    finished();
+  }
+  else {
+    queue_rest();
+  }
+
+  // Queued behind the pages
+  if (text_index)
+    index_start();
+
+  if (live_reload) {
+    file->prints = (u64 *) xcalloc(file->pages, sizeof(u64));
+    u32 i;
+    for (i = 0; i < file->pages; i++)
+      pool->submit(printtask, (void *) (uintptr_t) i, file->doc);
+
+    watch_file(filename);
+  }
+
+  return CORE_OK;
+}
+
+// Read the current file again after it changed, and have its pages
+// fingerprinted on the pool. MSG_RELOADED tells when core_reload_swap()
+// can replace the opened document by it. The old document stays if the
+// new one can't be read, likely because it's still being written.
+core_status core_reload(int *pdferror) {
+
+  if (!file->cache)
+    return CORE_OPEN_FAILED;
+
+  // A newer change, the one being compared is outdated
+  reload_cancel();
+
+  const int fd = open(file->filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) || st.st_size < 1) {
+    if (fd >= 0) close(fd);
+    return CORE_OPEN_FAILED;
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  u8 * const data = slurp(fd, st.st_size);
+  close(fd);
+  if (!data)
+    return CORE_MAP_FAILED;
+
+  PDFDoc * const pdf = memdoc(data, st.st_size);
+  if (!pdf->isOk() || pdf->getNumPages() < 1) {
+    const bool pdfok = pdf->isOk();
+    if (pdferror)
+      *pdferror = pdf->getErrorCode();
+
+    delete pdf;
+    free(data);
+    return pdfok ? CORE_NO_PAGES : CORE_PDF_ERROR;
+  }
+
+  reloading = new reloadfile();
+  reloading->pdf = pdf;
+  reloading->data = data;
+  reloading->size = st.st_size;
+  reloading->inode = st.st_ino;
+  reloading->mtime = (u64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  reloading->pages = pdf->getNumPages();
+  reloading->doc = ++documents;
+  reloading->prints = (u64 *) xcalloc(reloading->pages, sizeof(u64));
+  reloading->workers = (PDFDoc **) xcalloc(file->worker_count, sizeof(PDFDoc *));
+  reloading->pending = reloading->pages;
+
+  // Ahead of the rendering of the old one, which is about to go
+  u32 i;
+  for (i = reloading->pages; i-- > 0; )
+    pool->submit(reprinttask, (void *) (uintptr_t) i, reloading->doc, true);
+
+  return CORE_OK;
+}
+
+// Replace the opened document by the reloaded one, once all its pages
+// are fingerprinted. The pages that draw the same as before keep their
+// bitmap and text, the others render again, from the view on. False
+// if there is no such document, or not yet.
+bool core_reload_swap() {
+
+  if (!reloading || reloading->pending.load(std::memory_order_acquire))
+    return false;
+
+  const u64 span = trace_begin();
+
+  // Nothing touches the old document past this point
+  aborting.store(true, std::memory_order_release);
+  pool->cancel(file->doc);
+  aborting.store(false, std::memory_order_release);
+
+  scan_stop();
+  wordgrid_clear();
+  text_cache_clear();
+  index_clear();
+
+  PDFDoc * const pdf = reloading->pdf;
+  const u32 pages = reloading->pages;
+  u64 * const prints = reloading->prints;
+  u32 i;
+
+  cachedpage * const cache = new cachedpage[pages]();
+  u32 kept = 0;
+  u64 stored = 0;
+
+  for (i = 0; i < file->pages; i++) {
+    cachedpage * const old = &file->cache[i];
+    const bool inarena = file->arena && old->data >= file->arena &&
+                         old->data < file->arena + file->arena_size;
+
+    // Not fingerprinted in time counts as changed
+    if (i < pages && file->prints && prints[i] == file->prints[i] &&
+        page_ready(i)) {
+      cachedpage * const cur = &cache[i];
+
+      // The arena goes away, its pages are copied out
+      if (inarena) {
+        cur->data = (u8 *) xmalloc(old->size);
+        memcpy(cur->data, old->data, old->size);
+      }
+      else {
+        cur->data = old->data;
+      }
+
+      cur->size = old->size;
+      cur->uncompressed = old->uncompressed;
+      cur->w = old->w;
+      cur->h = old->h;
+      cur->left = old->left;
+      cur->right = old->right;
+      cur->top = old->top;
+      cur->bottom = old->bottom;
+      cur->text = old->text;
+      cur->state = PAGE_READY;
+      kept++;
+      stored += cur->size;
+    }
+    else {
+      if (!inarena)
+        free(old->data);
+      free(old->text);
+    }
+  }
+
+  delete [] file->cache;
+  file->cache = cache;
+
+  free(file->prints);
+  file->prints = prints;
+
+  if (file->arena) {
+    munmap(file->arena, file->arena_size);
+    file->arena = NULL;
+  }
+
+  // Those that fingerprinted the new one carry on with it
+  for (i = 0; i < file->worker_count; i++) {
+    delete file->workers[i];
+    file->workers[i] = reloading->workers[i];
+  }
+  free(reloading->workers);
+
+  delete file->pdf;
+  input_free(file->data, file->size, file->mapped);
+
+  file->pdf = pdf;
+  file->data = reloading->data;
+  file->size = reloading->size;
+  file->inode = reloading->inode;
+  file->mtime = reloading->mtime;
+  file->mapped = false;
+  file->pages = pages;
+  file->doc = reloading->doc;
+  file->hinted = 0;
+  file->rendered = kept;
+  file->ready = kept;
+  file->stored = stored;
+  file->complete = false;
+
+  delete reloading;
+  reloading = NULL;
+
+  if (file->first_visible >= pages)
+    file->first_visible = pages - 1;
+  if (file->last_visible >= pages)
+    file->last_visible = pages - 1;
+
+  free(file->stats);
+  file->stats = page_stats ? (pagestats *) xcalloc(pages, sizeof(pagestats)) : NULL;
+
+  gettimeofday(&file->started, NULL);
+  iocounters(&file->iobytes, &file->iofaults);
+
+  if (details)
+    printf(_("Reloaded %s, %u of %u pages unchanged\n"), file->filename, kept,
+      pages);
+
+  // The layout needs the first page, as for an open
+  if (!page_ready(0)) {
+    file->cache[0].state = PAGE_RENDERING;
+    renderpage(pdf, 0, &file->cache[0], text_layer);
+    pageready(0);
+    file->rendered++;
+  }
+
+  trace_end(TR_OPEN, span, 0);
+
+  if (file->rendered == pages) {
+    finished();
+  }
+  else {
+    // On the threads even with worker processes, which would redo
+    // every page
+    const u32 from = file->first_visible;
+    for (i = 0; i < pages; i++) {
+      const u32 page = (from + i) % pages;
+      if (!page_ready(page))
+        pool->submit(rendertask, (void *) (uintptr_t) page, file->doc);
+    }
+  }
+
+  if (text_index)
+    index_start();
+
+  return true;
+}
+
+// A page of the opened document, rendered by the caller if nobody
+// got to it yet. NULL past the end.
+const cachedpage *core_page(const u32 page) {
+
+  if (!file->cache || page >= file->pages)
+    return NULL;
+
+  // The worker processes hand out pages without claiming them
+  if (!render_processes && claim_page(page))
+    renderclaimed(page);
+
+  while (!page_ready(page))
+    usleep(1000);
+
+  return &file->cache[page];
+}
+
+// Wait for all the pages of the opened document
+void core_wait() {
+
+  while (file->cache && !file->complete.load())
+    usleep(1000);
+}
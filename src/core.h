@@ -0,0 +1,205 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Document loading, rendering and page cache, without any user
+// interface. The updf application and the headless tools both link
+// this part as libupdf-core.
+
+#ifndef CORE_H
+#define CORE_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <atomic>
+#include <lzo/lzo1x.h>
+
+#include <PDFDoc.h>
+
+#include "autoconfig.h"
+#include "gettext.h"
+#include "lrtypes.h"
+#include "macros.h"
+#include "helpers.h"
+#include "pool.h"
+#include "textlayer.h"
+
+// Pages are rasterized at this resolution, whatever the zoom
+#define RENDER_DPI 144
+
+extern u8 details;
+
+// Where the background tasks send their messages, -1 when nobody listens
+extern int writepipe;
+
+extern u32 render_processes;
+extern u32 render_threads;
+extern s32 render_nice;   // Nice value of the render threads
+extern bool text_layer;
+extern bool text_index;   // Index the words of each opened document
+extern bool page_stats;   // Time the steps of each page into openfile.stats
+extern bool live_reload;  // Follow the changes of the opened file
+extern bool assume_remote; // Read every file as on a network filesystem,
+                           // for the stress test
+
+// Life of a page. The render thread that moves a page out of
+// PAGE_RENDERING publishes its content with a release store, readers
+// must use page_ready() before looking at anything else.
+enum page_state {
+  PAGE_UNRENDERED = 0,
+  PAGE_RENDERING,
+  PAGE_READY
+};
+
+struct cachedpage {
+  u8  * data;
+  u32   size;
+  u32   uncompressed;
+
+  u32   w, h;
+  u16   left, right, top, bottom;
+
+  // Words of the page, when extracted in the same pass as the bitmap
+  textlayer * text;
+
+  std::atomic<u8> state;
+};
+
+// Time taken by each step of a page, in us, and the memory its
+// pipeline held at the peak, in kb: the bitmap, its trimmed copy and
+// the compression buffers. Poppler's own is not counted.
+struct pagestats {
+  u32 render;
+  u32 margins;
+  u32 compress;
+  u32 memory;
+};
+
+enum msg {
+  MSG_REFRESH = 0,
+  MSG_READY,
+  MSG_SEARCH,
+  MSG_TRACE,
+  MSG_RELOADED    // The reloaded document is compared, see core_reload()
+};
+
+struct openfile {
+  char       * filename;
+  cachedpage * cache;
+  PDFDoc     * pdf;
+  u32          maxw, maxh;
+
+  // The document content is in memory once and every render
+  // thread opens its own PDFDoc over it, so that they don't have to
+  // share poppler's XRef and stream states.
+  u8         * data;
+  u64          size;
+  bool         mapped;    // Else read in a malloc()ed buffer
+  std::atomic<bool> partial;  // Only the parts for the first page are read
+  u64          inode, mtime;  // Of the file read, mtime in ns
+  PDFDoc    ** workers;
+  u32          worker_count;
+
+  // Shared memory holding the pages rendered by worker processes
+  u8         * arena;
+  u64          arena_size;
+
+  u32          pages;
+
+  // Written by the UI, read by the render threads
+  std::atomic<u32> first_visible;
+  std::atomic<u32> last_visible;
+
+  u32          doc;       // Tags the render tasks of this document
+  u32          hinted;    // Last first_visible given to render_visible()
+  std::atomic<u32> rendered;  // Pages done
+  std::atomic<u32> ready;     // Pages published, for the overlay
+  std::atomic<u64> stored;    // Their compressed bytes
+  std::atomic<bool> complete; // finished() ran
+  pagestats  * stats;     // With page_stats, published with the page
+  u64        * prints;    // Page fingerprints with live_reload, 0 until known
+  timeval      started;
+  u64          iobytes, iofaults;   // I/O counters when rendering started
+};
+
+extern openfile * file;
+
+// Until the whole file is in file->data, see core_open()
+static inline void wait_loaded() {
+  while (file->partial.load(std::memory_order_acquire))
+    usleep(1000);
+}
+
+static inline bool page_ready(const u32 page) {
+  return file->cache[page].state.load(std::memory_order_acquire) == PAGE_READY;
+}
+
+// Take a page to render it, false if someone else has it or it's done
+static inline bool claim_page(const u32 page) {
+  u8 expected = PAGE_UNRENDERED;
+  return file->cache[page].state.compare_exchange_strong(expected, PAGE_RENDERING,
+                                                         std::memory_order_acq_rel);
+}
+
+enum core_status {
+  CORE_OK = 0,
+  CORE_OPEN_FAILED,   // Couldn't open or stat the file
+  CORE_MAP_FAILED,    // Couldn't map it in memory
+  CORE_PDF_ERROR,     // Poppler refused it, see the error code
+  CORE_NO_PAGES
+};
+
+void compress_init();
+void core_init();
+void core_threads(const u32 threads);
+core_status core_open(const char *filename, int *pdferror, const u32 first = 0,
+                      const u32 last = 0);
+core_status core_reload(int *pdferror);
+bool core_reload_swap();
+void core_close();
+const cachedpage *core_page(const u32 page);
+void core_wait();
+void core_message(const u8 msg);
+
+inline bool nonwhite(const u8 * const pixel) {
+
+  return pixel[0] != 255 ||
+    pixel[1] != 255 ||
+    pixel[2] != 255;
+}
+
+// The pixel kernels of renderpage(), apart for updf-microbench
+void getmargins(const u8 * const src, const u32 w, const u32 h,
+      const u32 rowsize, u32 *minx, u32 *maxx,
+      u32 *miny, u32 *maxy);
+u8 *trimcopy(const u8 * const src, const u32 rowsize, const u32 x, const u32 y,
+             const u32 w, const u32 h);
+u8 *compresspage(const u8 * const src, const u32 len, u32 * const outlen);
+void store(const u8 * const src, const u32 w, const u32 h,
+      const u32 rowsize, cachedpage * const out, const u32 page,
+      pagestats * const stats);
+
+PDFDoc *memdoc(const u8 * const data, const u64 size);
+PDFDoc *workerdoc();
+void renderpage(PDFDoc * const pdf, const u32 page, cachedpage * const out,
+                const bool withtext);
+void blankpage(const u32 page);
+void pageready(const u32 page);
+void render_visible(const u32 first, const u32 last);
+
+#endif
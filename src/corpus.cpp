@@ -0,0 +1,526 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// updf-corpus: write a set of synthetic PDF files shaped like the
+// documents we read, for the benchmarks. The output only depends on
+// the seed, so everyone measures on the same bytes.
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#include "helpers.h"
+#include "gettext.h"
+
+// Letter size, in points
+#define LETTER_W 612
+#define LETTER_H 792
+
+// The scanned pages are 100 dpi gray
+#define SCAN_W 850
+#define SCAN_H 1100
+
+static u32 seed;
+
+// Park-Miller, the same numbers on every platform
+static u32 rnd(const u32 max) {
+
+  seed = (u64) seed * 48271 % 2147483647;
+  return seed % max;
+}
+
+// Growable byte buffer
+struct buffer {
+  char * data;
+  u32    len, size;
+};
+
+static void put(buffer * const b, const char *fmt, ...) {
+
+  va_list ap;
+
+  while (true) {
+    va_start(ap, fmt);
+    const int n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+      die(_("Failed to format the PDF\n"));
+
+    if (b->len + n < b->size) {
+      b->len += n;
+      return;
+    }
+
+    b->size = (b->size + n) * 2;
+    b->data = (char *) xrealloc(b->data, b->size);
+  }
+}
+
+static void putbytes(buffer * const b, const u8 * const src, const u32 len) {
+
+  if (b->len + len > b->size) {
+    b->size = (b->len + len) * 2;
+    b->data = (char *) xrealloc(b->data, b->size);
+  }
+
+  memcpy(b->data + b->len, src, len);
+  b->len += len;
+}
+
+// A PDF being written. Object 1 is the catalog, 2 the page tree and
+// 3 the font, the pages follow. A linearized one starts with its
+// dictionary, object 4, filled in by pdfclose().
+struct pdfout {
+  FILE * f;
+  u32  * offsets;
+  u32    objects, size;
+  u32  * kids;
+  u32    pages;
+  u32    linear;     // Object of the linearization dictionary, 0 if none
+  u32    firstend;   // End of the first page and its content
+};
+
+static u32 newobj(pdfout * const p) {
+
+  if (p->objects + 1 >= p->size) {
+    p->size = (p->size + 16) * 2;
+    p->offsets = (u32 *) xrealloc(p->offsets, p->size * sizeof(u32));
+  }
+
+  return ++p->objects;
+}
+
+static void beginobj(pdfout * const p, const u32 obj) {
+
+  p->offsets[obj] = ftell(p->f);
+  fprintf(p->f, "%u 0 obj\n", obj);
+}
+
+// Fixed width, so that pdfclose() can write the values in place
+static void lineardict(pdfout * const p, const u32 length, const u32 xref) {
+
+  fprintf(p->f, "<< /Linearized 1 /L %010u /H [ 0 0 ] /O %010u /E %010u "
+    "/N %010u /T %010u >>\nendobj\n", length, p->pages ? p->kids[0] : 0,
+    p->firstend, p->pages, xref);
+}
+
+static void pdfopen(pdfout * const p, const char * const name,
+                    const bool linear = false) {
+
+  memset(p, 0, sizeof(pdfout));
+
+  p->f = fopen(name, "wb");
+  if (!p->f)
+    die(_("Can't create %s\n"), name);
+
+  fputs("%PDF-1.4\n%\xe2\xe3\xcf\xd3\n", p->f);
+
+  newobj(p);
+  newobj(p);
+  const u32 font = newobj(p);
+
+  // Only the first page part and the cross-reference table are laid out
+  // as linearized, no hint tables. Enough for firstpart() in the core.
+  if (linear) {
+    p->linear = newobj(p);
+    beginobj(p, p->linear);
+    lineardict(p, 0, 0);
+  }
+
+  beginobj(p, font);
+  fputs("<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>\nendobj\n", p->f);
+}
+
+// Add a page of the given size, with content and an optional gray image
+// drawn as /Im0
+static void addpage(pdfout * const p, const u32 w, const u32 h,
+                    const buffer * const content, const buffer * const image) {
+
+  const u32 page = newobj(p);
+  const u32 stream = newobj(p);
+  const u32 img = image ? newobj(p) : 0;
+
+  beginobj(p, page);
+  fprintf(p->f, "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 %u %u]\n"
+    "   /Resources << /Font << /F1 3 0 R >>", w, h);
+  if (img)
+    fprintf(p->f, " /XObject << /Im0 %u 0 R >>", img);
+  fprintf(p->f, " >>\n   /Contents %u 0 R >>\nendobj\n", stream);
+
+  beginobj(p, stream);
+  fprintf(p->f, "<< /Length %u >>\nstream\n", content->len);
+  fwrite(content->data, 1, content->len, p->f);
+  fputs("\nendstream\nendobj\n", p->f);
+
+  if (img) {
+    beginobj(p, img);
+    fprintf(p->f, "<< /Type /XObject /Subtype /Image /Width %u /Height %u\n"
+      "   /ColorSpace /DeviceGray /BitsPerComponent 8 /Length %u >>\nstream\n",
+      SCAN_W, SCAN_H, image->len);
+    fwrite(image->data, 1, image->len, p->f);
+    fputs("\nendstream\nendobj\n", p->f);
+  }
+
+  if (!(p->pages & 255))
+    p->kids = (u32 *) xrealloc(p->kids, (p->pages + 256) * sizeof(u32));
+  p->kids[p->pages++] = page;
+
+  if (p->pages == 1)
+    p->firstend = ftell(p->f);
+}
+
+static void pdfclose(pdfout * const p) {
+
+  u32 i;
+
+  beginobj(p, 2);
+  fputs("<< /Type /Pages /Kids [", p->f);
+  for (i = 0; i < p->pages; i++)
+    fprintf(p->f, "%s%u 0 R", (i & 7) ? " " : "\n", p->kids[i]);
+  fprintf(p->f, "\n] /Count %u >>\nendobj\n", p->pages);
+
+  beginobj(p, 1);
+  fputs("<< /Type /Catalog /Pages 2 0 R >>\nendobj\n", p->f);
+
+  const u32 xref = ftell(p->f);
+  fprintf(p->f, "xref\n0 %u\n0000000000 65535 f \n", p->objects + 1);
+  for (i = 1; i <= p->objects; i++)
+    fprintf(p->f, "%010u 00000 n \n", p->offsets[i]);
+
+  fprintf(p->f, "trailer\n<< /Size %u /Root 1 0 R >>\nstartxref\n%u\n%%%%EOF\n",
+    p->objects + 1, xref);
+
+  if (p->linear) {
+    const u32 length = ftell(p->f);
+    fseek(p->f, p->offsets[p->linear], SEEK_SET);
+    fprintf(p->f, "%u 0 obj\n", p->linear);
+    lineardict(p, length, xref);
+  }
+
+  if (fclose(p->f))
+    die(_("Failed writing the PDF\n"));
+
+  free(p->offsets);
+  free(p->kids);
+}
+
+static const char * const words[] = {
+  "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+  "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+  "et", "dolore", "magna", "aliqua", "enim", "ad", "minim", "veniam",
+  "quis", "nostrud", "exercitation", "ullamco", "laboris", "nisi",
+  "aliquip", "ex", "ea", "commodo", "consequat", "render", "page", "cache"
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+// Lines of text filling the box, in points
+static void text(buffer * const b, const u32 x, const u32 y,
+                 const u32 w, const u32 h, const u32 size) {
+
+  const u32 lead = size + size / 4;
+  const u32 chars = w * 2 / size;
+  u32 line;
+
+  put(b, "BT /F1 %u Tf %u TL %u %u Td\n", size, lead, x, y + h - size);
+  for (line = 0; line + 1 < h / lead; line++) {
+    u32 len = 0;
+
+    put(b, "(");
+    while (true) {
+      const char * const word = words[rnd(WORD_COUNT)];
+      const u32 wl = strlen(word) + 1;
+      if (len + wl > chars)
+        break;
+      put(b, "%s ", word);
+      len += wl;
+    }
+    put(b, ") Tj T*\n");
+  }
+  put(b, "ET\n");
+}
+
+static void vectors(buffer * const b, const u32 w, const u32 h, const u32 count) {
+
+  u32 i;
+  for (i = 0; i < count; i++) {
+    // One draw per statement, argument order is up to the compiler
+    const u32 x = 36 + rnd(w - 72), y = 36 + rnd(h - 72);
+    const u32 kind = rnd(3);
+    const u32 a = rnd(100), c = rnd(100), d = rnd(100);
+    const u32 x1 = 36 + rnd(w - 72), y1 = 36 + rnd(h - 72);
+    const u32 x2 = 36 + rnd(w - 72), y2 = 36 + rnd(h - 72);
+    const u32 x3 = 36 + rnd(w - 72), y3 = 36 + rnd(h - 72);
+
+    switch (kind) {
+      case 0:
+        put(b, "%.2f %.2f %.2f RG %u %u m %u %u l S\n",
+          a / 100.0f, c / 100.0f, d / 100.0f, x, y, x1, y1);
+      break;
+      case 1:
+        put(b, "%.2f g %u %u %u %u re f\n", a / 100.0f,
+          x, y, 1 + c % 40, 1 + d % 40);
+      break;
+      default:
+        put(b, "%u %u m %u %u %u %u %u %u c S\n", x, y, x1, y1, x2, y2, x3, y3);
+      break;
+    }
+  }
+}
+
+// A gray page with speckle noise and dark lines of "print"
+static void scan(buffer * const b) {
+
+  u8 row[SCAN_W];
+  u32 x, y;
+
+  b->len = 0;
+  for (y = 0; y < SCAN_H; y++) {
+    const bool printed = y > 80 && y < SCAN_H - 80 && (y % 24) < 12;
+
+    for (x = 0; x < SCAN_W; x++) {
+      u8 v = 235 + rnd(20);
+      if (printed && x > 80 && x < SCAN_W - 80 && rnd(3) == 0)
+        v = rnd(80);
+      row[x] = v;
+    }
+    putbytes(b, row, SCAN_W);
+  }
+}
+
+static void gen_text(const char * const name) {
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name);
+  for (i = 0; i < 300; i++) {
+    b.len = 0;
+    text(&b, 54, 54, LETTER_W - 108, LETTER_H - 108, 10);
+    addpage(&p, LETTER_W, LETTER_H, &b, NULL);
+  }
+  pdfclose(&p);
+  free(b.data);
+}
+
+static void gen_vector(const char * const name) {
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name);
+  for (i = 0; i < 100; i++) {
+    b.len = 0;
+    vectors(&b, LETTER_W, LETTER_H, 5000);
+    addpage(&p, LETTER_W, LETTER_H, &b, NULL);
+  }
+  pdfclose(&p);
+  free(b.data);
+}
+
+static void gen_scan(const char * const name) {
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 }, img = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name);
+  for (i = 0; i < 40; i++) {
+    b.len = 0;
+    put(&b, "q %u 0 0 %u 0 0 cm /Im0 Do Q\n", LETTER_W, LETTER_H);
+    scan(&img);
+    addpage(&p, LETTER_W, LETTER_H, &b, &img);
+  }
+  pdfclose(&p);
+  free(b.data);
+  free(img.data);
+}
+
+static void gen_huge(const char * const name) {
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name);
+  for (i = 0; i < 12000; i++) {
+    b.len = 0;
+    text(&b, 72, LETTER_H / 2, LETTER_W - 144, 120, 12);
+    addpage(&p, LETTER_W, LETTER_H, &b, NULL);
+  }
+  pdfclose(&p);
+  free(b.data);
+}
+
+static void gen_mixed(const char * const name) {
+
+  // Letter, A4, A5, legal, tabloid, letter landscape
+  static const u32 sizes[][2] = {
+    { 612, 792 }, { 595, 842 }, { 420, 595 },
+    { 612, 1008 }, { 792, 1224 }, { 792, 612 }
+  };
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name);
+  for (i = 0; i < 200; i++) {
+    const u32 *s = sizes[rnd(sizeof(sizes) / sizeof(sizes[0]))];
+    b.len = 0;
+    text(&b, 48, 48, s[0] - 96, s[1] - 96, 8 + rnd(6));
+    addpage(&p, s[0], s[1], &b, NULL);
+  }
+  pdfclose(&p);
+  free(b.data);
+}
+
+static void gen_margins(const char * const name) {
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name);
+  for (i = 0; i < 150; i++) {
+    b.len = 0;
+    // A column in the middle, the rest of the page white
+    text(&b, 200 + rnd(20), 220, 200, 340, 9);
+    addpage(&p, LETTER_W, LETTER_H, &b, NULL);
+  }
+  pdfclose(&p);
+  free(b.data);
+}
+
+static void gen_blank(const char * const name) {
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name);
+  for (i = 0; i < 150; i++) {
+    b.len = 0;
+    if (i % 3)
+      put(&b, "%% blank\n");
+    else
+      text(&b, 54, 54, LETTER_W - 108, LETTER_H - 108, 10);
+    addpage(&p, LETTER_W, LETTER_H, &b, NULL);
+  }
+  pdfclose(&p);
+  free(b.data);
+}
+
+// Text pages with the first one first, as read over a network
+static void gen_linear(const char * const name) {
+
+  pdfout p;
+  buffer b = { NULL, 0, 0 };
+  u32 i;
+
+  pdfopen(&p, name, true);
+  for (i = 0; i < 120; i++) {
+    b.len = 0;
+    text(&b, 54, 54, LETTER_W - 108, LETTER_H - 108, 10);
+    addpage(&p, LETTER_W, LETTER_H, &b, NULL);
+  }
+  pdfclose(&p);
+  free(b.data);
+}
+
+struct shape {
+  const char * name;
+  void (*gen)(const char *);
+};
+
+static const shape shapes[] = {
+  { "text",    gen_text },
+  { "vector",  gen_vector },
+  { "scan",    gen_scan },
+  { "huge",    gen_huge },
+  { "mixed",   gen_mixed },
+  { "margins", gen_margins },
+  { "blank",   gen_blank },
+  { "linear",  gen_linear },
+  { NULL,      NULL }
+};
+
+int main(int argc, char **argv) {
+
+  const char *dir = "corpus";
+  u32 start = 1;
+
+  const struct option opts[] = {
+    { "output", 1, NULL, 'o' },
+    { "seed",   1, NULL, 's' },
+    { "help",   0, NULL, 'h' },
+    { NULL,     0, NULL,  0  }
+  };
+
+  while (1) {
+    const int c = getopt_long(argc, argv, "ho:s:", opts, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'o':
+        dir = optarg;
+      break;
+      case 's':
+        start = strtoul(optarg, NULL, 10);
+      break;
+      case 'h':
+      default:
+        printf(_("Usage: %s [options] [shape...]\n\n"
+          "   -h --help   This help\n"
+          "   -o --output DIR     Write the files there (default: corpus)\n"
+          "   -s --seed N         Seed of the content (default: 1)\n\n"
+          "Shapes: text vector scan huge mixed margins blank linear\n"
+          "        (default: all)\n"),
+          argv[0]);
+        return 0;
+      break;
+    }
+  }
+
+  if (mkdir(dir, 0755) && errno != EEXIST)
+    die(_("Can't create %s\n"), dir);
+
+  u32 i;
+  for (i = 0; shapes[i].name; i++) {
+    if (optind < argc) {
+      int a;
+      for (a = optind; a < argc && strcmp(argv[a], shapes[i].name); a++);
+      if (a == argc)
+        continue;
+    }
+
+    char name[PATH_MAX];
+    snprintf(name, PATH_MAX, "%s/%s.pdf", dir, shapes[i].name);
+
+    // Each file gets its own stream, so that picking shapes changes nothing
+    seed = (start * 2654435761u + i) % 2147483646 + 1;
+
+    shapes[i].gen(name);
+    printf("%s\n", name);
+  }
+
+  return 0;
+}
@@ -36,6 +36,14 @@ void *xmalloc(size_t size) {
 	return tmp;
 }
 
+void *xrealloc(void *ptr, size_t size) {
+
+	void *tmp = realloc(ptr, size);
+	if (!tmp) die("Out of memory\n");
+
+	return tmp;
+}
+
 void die(const char fmt[], ...) {
 
 	va_list ap;
@@ -154,6 +162,22 @@ ssize_t swrite(const int fd, const void *buf, const size_t count) {
 	return written;
 }
 
+// Print s to stdout as a quoted JSON string
+void jsonstr(const char *s) {
+
+	putchar('"');
+	for (; *s; s++) {
+		const u8 c = *s;
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 32)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
 #if DEBUGGING
 
   void debug_it(char const * fmt, ...)
@@ -166,37 +190,5 @@ ssize_t swrite(const int fd, const void *buf, const size_t count) {
 
     va_end(ap);
   }
-
-  void debug_it(Fl_Box * ctrl, const float value, const char * hint) 
-  {
-    char tmp[20];
-
-    snprintf(tmp, 20, "%5.3f", value);
-    ctrl->copy_label(tmp);
-    ctrl->tooltip(hint);
-    ctrl->redraw_label();
-  }
-
-  void debug_it(Fl_Box * ctrl, const u32 value, const char * hint) 
-  {
-    char tmp[20];
-
-    snprintf(tmp, 20, "%u", value);
-    ctrl->copy_label(tmp);
-    ctrl->tooltip(hint);
-    ctrl->redraw_label();
-    Fl::check();
-  }
-
-  void debug_it(Fl_Box * ctrl, const s32 value, const char * hint) 
-  {
-    char tmp[20];
-
-    snprintf(tmp, 20, "%d", value);
-    ctrl->copy_label(tmp);
-    ctrl->tooltip(hint);
-    ctrl->redraw_label();
-    Fl::check();
-  }
 #endif
 
@@ -24,14 +24,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <errno.h>
 #include <sys/time.h>
 
-#include "main.h"
 #include "lrtypes.h"
 
+#define DEBUGGING 1
+
 #define PRINTF_WARNINGS(a,b) __attribute__ ((format (printf, a, b)))
 
 // helpers
 void *xcalloc(size_t nmemb, size_t size);
 void *xmalloc(size_t size);
+void *xrealloc(void *ptr, size_t size);
 void die(const char fmt[], ...) PRINTF_WARNINGS(1, 2) __attribute__ ((noreturn));
 void err(const char fmt[], ...) PRINTF_WARNINGS(1, 2);
 float clampf(float in, float low, float high);
@@ -44,6 +46,7 @@ u64 msec();
 int allspace(const char *in);
 ssize_t sread(const int fd, void *buf, const size_t count);
 ssize_t swrite(const int fd, const void *buf, const size_t count);
+void jsonstr(const char *s);
 
 static inline u32 u32max(u32 a, u32 b) {
 	if (a > b) return a;
@@ -55,9 +58,6 @@ static inline u32 u32max(u32 a, u32 b) {
   #define debug debug_it
 
   void debug_it(char const * fmt, ...);
-  void debug_it(Fl_Box * ctrl, const float value, const char * hint);
-  void debug_it(Fl_Box * ctrl, const s32   value, const char * hint);
-  void debug_it(Fl_Box * ctrl, const u32   value, const char * hint);
 
 #else
   #define debug(...)
@@ -0,0 +1,247 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "main.h"
+#include "latency.h"
+#include <time.h>
+#include <unistd.h>
+
+// Log-linear buckets, as in HdrHistogram: values below HIST_SUB are
+// exact, above that each power of two is cut in HIST_SUB / 2 buckets,
+// so a value is known within 1 / 16th.
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((32 - HIST_SUB_BITS + 1) * HIST_SUB / 2 + HIST_SUB / 2)
+
+#define MODES 6
+
+#define STARTUP_MARKS 16
+
+struct histogram {
+  u32 counts[HIST_BUCKETS];
+  u32 total;
+  u32 max;
+};
+
+// Only touched by the UI thread
+static histogram hists[LAT_KINDS][MODES][MAX_COLUMNS_COUNT];
+
+static char *output = NULL;
+
+bool startup_timing = false;
+
+struct startupmark {
+  const char *what;
+  u64 when;
+};
+
+static startupmark marks[STARTUP_MARKS];
+static u32 markcount = 0;
+static s64 execat = -1;   // latency_now() of the exec, -1 if unknown
+static bool drawn = false;
+
+static const char * const modenames[MODES] = {
+  "Trim", "Width", "Page", "PgTrim", "MyTrim", "Custom"
+};
+
+static const char * const kindnames[LAT_KINDS] = {
+  "Frame draw", "Input to frame"
+};
+
+u64 latency_now() {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (u64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static u32 bucket(const u32 v) {
+
+  if (v < HIST_SUB)
+    return v;
+
+  const u32 shift = 31 - __builtin_clz(v) - HIST_SUB_BITS + 1;
+  return shift * (HIST_SUB / 2) + (v >> shift);
+}
+
+// The largest value that falls in the bucket
+static u32 highest(const u32 b) {
+
+  if (b < HIST_SUB)
+    return b;
+
+  const u32 shift = b / (HIST_SUB / 2) - 1;
+  const u32 sub = b % (HIST_SUB / 2) + HIST_SUB / 2;
+
+  return (((u64) sub + 1) << shift) - 1;
+}
+
+void latency_record(const u8 kind, const u32 mode, const u32 columns, const u32 us) {
+
+  if (kind >= LAT_KINDS || mode >= MODES || !columns || columns > MAX_COLUMNS_COUNT)
+    return;
+
+  histogram * const h = &hists[kind][mode][columns - 1];
+
+  h->counts[bucket(us)]++;
+  h->total++;
+  if (us > h->max)
+    h->max = us;
+}
+
+static u32 percentile(const histogram * const h, const float p) {
+
+  const u32 want = ceilf(h->total * p);
+  u32 seen = 0, b;
+
+  for (b = 0; b < HIST_BUCKETS; b++) {
+    seen += h->counts[b];
+    if (seen >= want)
+      return highest(b) < h->max ? highest(b) : h->max;
+  }
+
+  return h->max;
+}
+
+void latency_print(FILE * const f) {
+
+  u32 k, m, c;
+
+  for (k = 0; k < LAT_KINDS; k++) {
+    fprintf(f, _("%-16s  columns    count      p50      p95      p99      max (us)\n"),
+      kindnames[k]);
+
+    for (m = 0; m < MODES; m++) {
+      for (c = 0; c < MAX_COLUMNS_COUNT; c++) {
+        const histogram * const h = &hists[k][m][c];
+        if (!h->total)
+          continue;
+
+        fprintf(f, "  %-14s  %7u  %7u  %7u  %7u  %7u  %7u\n", modenames[m], c + 1,
+          h->total, percentile(h, 0.50f), percentile(h, 0.95f),
+          percentile(h, 0.99f), h->max);
+      }
+    }
+  }
+}
+
+void latency_reset() {
+
+  memset(hists, 0, sizeof(hists));
+}
+
+// Where latency_save() writes, set from the command line
+void latency_output(const char *filename) {
+
+  output = strdup(filename);
+}
+
+void latency_save() {
+
+  if (!output)
+    return;
+
+  FILE * const f = fopen(output, "w");
+  if (!f) {
+    err(_("Can't write the latencies to %s\n"), output);
+    return;
+  }
+
+  latency_print(f);
+
+  if (fclose(f))
+    err(_("Can't write the latencies to %s\n"), output);
+}
+
+// When the process started, from /proc. The kernel keeps it in clock
+// ticks since boot, so it's only known within a tick, usually 10 ms.
+static s64 exectime() {
+
+  FILE * const f = fopen("/proc/self/stat", "r");
+  if (!f)
+    return -1;
+
+  char buf[1024];
+  const size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[len] = 0;
+
+  // The name may hold spaces and parentheses, skip after the last one
+  const char * const p = strrchr(buf, ')');
+  unsigned long long ticks;
+  if (!p || sscanf(p + 1, " %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+                   "%*s %*s %*s %*s %*s %*s %*s %llu", &ticks) != 1)
+    return -1;
+
+  struct timespec boot;
+  clock_gettime(CLOCK_BOOTTIME, &boot);
+
+  const u64 sinceboot = (u64) boot.tv_sec * 1000000 + boot.tv_nsec / 1000;
+  const u64 started = ticks * 1000000 / sysconf(_SC_CLK_TCK);
+
+  return latency_now() - (sinceboot - started);
+}
+
+void startup_mark(const char *what) {
+
+  if (execat < 0 && !markcount)
+    execat = exectime();
+
+  if (markcount < STARTUP_MARKS) {
+    marks[markcount].what = what;
+    marks[markcount].when = latency_now();
+    markcount++;
+  }
+}
+
+static void startup_report(FILE * const f) {
+
+  const u64 origin = execat >= 0 ? execat : marks[0].when;
+  u32 i;
+
+  fprintf(f, execat >= 0 ? _("Startup, ms since exec:\n") :
+                           _("Startup, ms since main:\n"));
+
+  for (i = 0; i < markcount; i++) {
+    const u64 prev = i ? marks[i - 1].when : origin;
+    fprintf(f, "  %-12s  %8.1f  %+8.1f\n", marks[i].what,
+            (marks[i].when - origin) / 1000.0f,
+            (marks[i].when - prev) / 1000.0f);
+  }
+}
+
+// After the frame is copied to the window, wait for the X server
+static void cb_firstpixel(void *) {
+
+  XSync(fl_display, False);
+  startup_mark("first pixel");
+
+  if (startup_timing || details)
+    startup_report(stderr);
+  if (startup_timing)
+    exit(0);
+}
+
+// Called at the end of each draw() with pages on screen
+void startup_drawn() {
+
+  if (drawn)
+    return;
+  drawn = true;
+
+  Fl::add_timeout(0, cb_firstpixel);
+}
@@ -0,0 +1,43 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+
+#include "lrtypes.h"
+
+enum latency_kind {
+  LAT_FRAME = 0,    // Time spent in draw()
+  LAT_INPUT,        // From an input event to the end of the frame showing it
+  LAT_KINDS
+};
+
+u64  latency_now();
+void latency_record(const u8 kind, const u32 mode, const u32 columns, const u32 us);
+void latency_print(FILE * const f);
+void latency_reset();
+void latency_output(const char *filename);
+void latency_save();
+
+// Time to the first page on screen
+extern bool startup_timing;
+
+void startup_mark(const char *what);
+void startup_drawn();
+
+#endif
@@ -0,0 +1,265 @@
+/*
+Copyright (C) 2015 Lauri Kasanen
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Modifications Copyright (C) 2016 Guy Turcotte
+*/
+
+#include "core.h"
+#include "layout.h"
+
+const trim_struct *layout_trim(const my_trim_struct * const my_trim, const s32 page)
+{
+  single_page_trim_struct * curr = my_trim->singles;
+  const trim_struct * result;
+
+  while (curr && (curr->page < page)) curr = curr->next;
+
+  if (curr && (curr->page == page)) {
+    result = &curr->page_trim;
+  }
+  else {
+    if (page & 1) {
+      result = &my_trim->even;
+    }
+    else {
+      result = &my_trim->odd;
+    }
+  }
+
+  return result;
+}
+
+u32 layout_pageh(const layout * const l, u32 page)
+{
+  if (!page_ready(page)) page = 0;
+
+  s32 h;
+
+  if (l->mode == Z_TRIM || l->mode == Z_PGTRIM) {
+    h = file->cache[page].h;
+  }
+  else if (l->mode == Z_MYTRIM && !l->trim_zone_selection) {
+    if (l->my_trim->initialized) {
+      const trim_struct * the_trim = layout_trim(l->my_trim, page);
+      h = the_trim->H;
+    }
+    else {
+      return file->cache[page].h;
+    }
+  }
+  else { // Z_PAGE || Z_WIDTH || Z_CUSTOM || (Z_MYTRIM && trim_zone_selection)
+    return  file->cache[page].h +
+        file->cache[page].top   +
+        file->cache[page].bottom;
+  }
+
+  return h < 2*MARGIN ? h + MARGIN : h;
+}
+
+u32 layout_pagew(const layout * const l, u32 page)
+{
+  if (!page_ready(page)) page = 0;
+
+  if (l->mode == Z_TRIM || l->mode == Z_PGTRIM) {
+    return file->cache[page].w;
+  }
+  else if (l->mode == Z_MYTRIM && !l->trim_zone_selection) {
+    if (l->my_trim->initialized) {
+      const trim_struct * the_trim = layout_trim(l->my_trim, page);
+      return  the_trim->W;
+    }
+    else {
+      return file->cache[page].w;
+    }
+  }
+  else { // Z_PAGE || Z_WIDTH || Z_CUSTOM || (Z_MYTRIM && trim_zone_selection)
+    return file->cache[page].w +
+        file->cache[page].left  +
+        file->cache[page].right;
+  }
+}
+
+// Compute the height of a line of pages, selecting the page that is the
+// largest in height.
+u32 layout_fullh(const layout * const l, u32 page)
+{
+  if (!page_ready(page)) page = 0;
+
+  u32 fh = 0;
+  u32 h;
+  u32 i, limit;
+
+  if ((l->title_pages > 0) && (l->title_pages < l->columns) && (page < l->title_pages)) {
+    limit = l->title_pages;
+  }
+  else {
+    limit = page + l->columns;
+  }
+
+  if (limit > file->pages) limit = file->pages;
+
+  for (i = page; i < limit; i++) {
+    h = layout_pageh(l, i);
+    if (h > fh) fh = h;
+  }
+
+  return fh;
+}
+
+// Compute the width of a line of pages. The page number is the one that is
+// the first on the left of the line.
+u32 layout_fullw(const layout * const l, const u32 page)
+{
+  u32 fw = 0;
+  u32 i, limit;
+
+  if ((l->title_pages > 0) && (l->title_pages < l->columns) && (page < l->title_pages)) {
+    limit = l->title_pages;
+  }
+  else {
+    limit = page + l->columns;
+  }
+
+  if (limit > file->pages) limit = file->pages;
+
+  for (i = page; i < (page + l->columns); i++) {
+    fw += layout_pagew(l, i < limit ? i : 0);
+  }
+
+  // Add the margins between columns
+  return fw + (l->columns - 1) * MARGINHALF;
+}
+
+// A conservative last page on screen, when the first one is at the top.
+// Only draw() knows it exactly. It may be past the end of the document.
+u32 layout_lastvisible(const u32 first, const u32 columns)
+{
+  static const u32 max_lines_per_screen[MAX_COLUMNS_COUNT] = { 2, 3, 4, 5, 6 };
+
+  const u32 cols = columns < 1 ? 1 :
+                   columns > MAX_COLUMNS_COUNT ? MAX_COLUMNS_COUNT : columns;
+
+  return first + max_lines_per_screen[cols - 1] * cols;
+}
+
+bool layout_hasmargins(const u32 page)
+{
+  if (!page_ready(page)) {
+    return
+      file->cache[0].left   > MARGIN ||
+      file->cache[0].right  > MARGIN ||
+      file->cache[0].top    > MARGIN ||
+      file->cache[0].bottom > MARGIN;
+  }
+
+  return
+    file->cache[page].left   > MARGIN ||
+    file->cache[page].right  > MARGIN ||
+    file->cache[page].top    > MARGIN ||
+    file->cache[page].bottom > MARGIN;
+}
+
+// Compute the required zoom factor to fit the line of pages on the screen,
+// according to the zoom mode parameter if not a custom zoom.
+float layout_zoom(const layout * const l, const u32 first_page,
+                  u32 &width, u32 &height)
+{
+  const u32 line_width  = layout_fullw(l, first_page);
+  const u32 line_height = layout_fullh(l, first_page);
+
+  float zoom_factor;
+
+  switch (l->mode) {
+    case Z_TRIM:
+    case Z_WIDTH:
+      zoom_factor = (float)l->screen_width / line_width;
+      break;
+    case Z_PAGE:
+    case Z_PGTRIM:
+    case Z_MYTRIM:
+      if (((float)line_width / line_height) > ((float)l->screen_width / l->screen_height)) {
+        zoom_factor = (float)l->screen_width / line_width;
+      }
+      else {
+        zoom_factor = (float)l->screen_height / line_height;
+      }
+      break;
+    default:
+      zoom_factor = l->zoom;
+      break;
+  }
+
+  width  = line_width;
+  height = line_height;
+
+  return zoom_factor;
+}
+
+// Compute the vertical screen size of a line of pages
+u32 layout_pxrel(const layout * const l, const u32 page)
+{
+  float zoom;
+  u32 line_width, line_height;
+
+  zoom = layout_zoom(l, page, line_width, line_height);
+  return line_height * zoom;
+}
+
+// The largest y offset, where the last line of pages ends at the bottom
+// of the screen
+float layout_maxyoff(const layout * const l)
+{
+  float zoom, f;
+  u32   line_width, line_height, h;
+
+  const s32 columns = l->columns;
+  const s32 title_pages = l->title_pages;
+
+  s32 pages = file->pages;
+  s32 last  = pages - 1;
+  last     -= (last % columns);
+  if ((title_pages > 0) && (title_pages < columns)) {
+    last -= (columns - title_pages);
+    if (last < (pages - columns)) {
+      last += columns;
+    }
+  }
+
+  if (last < 0) last = 0;
+
+  if (!page_ready(last))
+    f = last + 0.5f;
+  else {
+    s32 H = l->screen_height;
+
+    while (true) {
+      zoom = layout_zoom(l, last, line_width, line_height);
+      H   -= (h = zoom * (line_height + MARGINHALF));
+
+      if (H <= 0) {
+        H += (MARGINHALF * zoom);
+        f = last + (float)(-H) / (zoom * line_height);
+        break;
+      }
+
+      last -= columns;
+      if (last < 0) {
+        f = 0.0f;
+        break;
+      }
+    }
+  }
+  return f;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "lrtypes.h"
+#include "config.h"
+
+// Quarter inch in double resolution
+#define MARGIN 36
+#define MARGINHALF 18
+
+const int MAX_COLUMNS_COUNT = 5;
+
+// How the pages of the opened document are placed on a screen. The
+// view fills one from its settings, the headless tools from theirs.
+struct layout {
+  view_mode_enum         mode;
+  bool                   trim_zone_selection;
+  const my_trim_struct * my_trim;
+  u32                    columns, title_pages;
+  s32                    screen_width, screen_height;
+  float                  zoom;    // For Z_CUSTOM
+};
+
+const trim_struct *layout_trim(const my_trim_struct * const my_trim, const s32 page);
+bool  layout_hasmargins(const u32 page);
+
+u32   layout_pageh(const layout * const l, u32 page);
+u32   layout_pagew(const layout * const l, u32 page);
+u32   layout_fullh(const layout * const l, u32 page);
+u32   layout_fullw(const layout * const l, const u32 page);
+float layout_zoom(const layout * const l, const u32 first_page,
+                  u32 &width, u32 &height);
+u32   layout_pxrel(const layout * const l, const u32 page);
+float layout_maxyoff(const layout * const l);
+u32   layout_lastvisible(const u32 first, const u32 columns);
+
+#endif
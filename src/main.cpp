@@ -17,11 +17,20 @@ Modifications Copyright (C) 2016 Guy Turcotte
 */
 
 #include "main.h"
+#include "notify.h"
+#include "search.h"
+#include "scan.h"
+#include "trace.h"
+#include "latency.h"
+#include "replay.h"
+#include "watch.h"
+#include "procrender.h"
 #include "updf 128x128.h"
 #include "updf 64x64.h"
 #include "icons 32x32.h"
 
 #include <getopt.h>
+#include <signal.h>
 #include <ctype.h>
 #include <cstdlib>
 #include <unistd.h>
@@ -34,15 +43,27 @@ using namespace libconfig;
 #define LABEL_SIZE   11
 #define CHOICE_SIZE   9
 
+// Minimum time between two refreshes caused by rendered pages
+#define FRAME_MS     16
+
+// Quiet time after a write of the file before reloading it
+#define RELOAD_DELAY 0.3
+
+// Pause in the typing of a phrase or expression before scanning for it,
+// each scan reads the text of every page
+#define SCAN_DELAY   0.4
+
 static Fl_Double_Window  * win                     = NULL;
-static Fl_Input          * page_input              = NULL;
+static Fl_Input          * page_input              = NULL,
+                         * search_input            = NULL;
 static Fl_Input_Choice   * zoombar                 = NULL;
 static Fl_Light_Button   * selecting               = NULL,
                          * selecting_trim_zone     = NULL,
                          * this_page_trim          = NULL,
                          * diff_trim_zone          = NULL;
        
-static Fl_Box            * pagectr                 = NULL;
+static Fl_Box            * pagectr                 = NULL,
+                         * searchctr               = NULL;
 
 static PDFView           * view                    = NULL;
 
@@ -58,6 +79,51 @@ static Fl_Pack           * win_pack                = NULL,
 static Fl_Button         * show_btn                = NULL,
                          * fullscreen_btn          = NULL;
 
+enum icon_id {
+  ICON_FULLSCREEN,
+  ICON_RESTORE,
+  ICON_UPDF64,
+  ICON_UPDF128,
+  ICON_BACK,
+  ICON_OPEN,
+  ICON_RECENT,
+  ICON_ZOOMIN,
+  ICON_ZOOMOUT,
+  ICON_TEXT,
+  ICON_TOP,
+  ICON_UP,
+  ICON_BOTTOM,
+  ICON_DOWN,
+  ICON_EXIT,
+  ICON_COUNT
+};
+
+#define img(a) a, sizeof(a)
+
+static const struct {
+  const char          * name;
+  const unsigned char * data;
+  int                   size;
+} icondata[ICON_COUNT] = {
+  { "fullscreen.png",        img(view_fullscreen_png) },
+  { "fullscreenreverse.png", img(view_restore_png) },
+  { "updf 64x64.png",        img(updf_64x64_png) },
+  { "updf-128x128.png",      img(updf_128x128_png) },
+  { "back.png",              img(media_seek_backward_png) },
+  { "fileopen.png",          img(document_open_png) },
+  { "fileopen.png",          img(emblem_documents_png) },
+  { "zoomin.png",            img(zoom_in_png) },
+  { "zoomout.png",           img(zoom_out_png) },
+  { "text.png",              img(edit_select_all_png) },
+  { "pagetop.png",           img(go_top_png) },
+  { "pageup.png",            img(go_up_png) },
+  { "pagebottom.png",        img(go_bottom_png) },
+  { "pagedown.png",          img(go_down_png) },
+  { "exit.png",              img(application_exit_png) },
+};
+
+static Fl_PNG_Image      * icons[ICON_COUNT];
+
 static Fl_PNG_Image      * fullscreen_image        = NULL,
                          * fullscreenreverse_image = NULL;
 
@@ -69,16 +135,6 @@ static Fl_Window         * recent_win              = NULL;
 static Fl_Select_Browser * recent_select           = NULL,
                          * trim_pages_browser      = NULL;
 
-#if DEBUGGING
-  Fl_Box                 * debug1                  = NULL,
-                         * debug2                  = NULL,
-                         * debug3                  = NULL,
-                         * debug4                  = NULL,
-                         * debug5                  = NULL,
-                         * debug6                  = NULL,
-                         * debug7                  = NULL;
-#endif
-
 static Fl_Menu_Item menu_zoombar[] = {
   { "Trim",   0, 0, 0, 0, FL_NORMAL_LABEL, 0, 11, 0 },
   { "Width",  0, 0, 0, 0, FL_NORMAL_LABEL, 0, 11, 0 },
@@ -106,12 +162,8 @@ static Fl_Menu_Item menu_title_pages[] = {
   { 0,0,0,0,0,0,0,0,0 }
 };
 
-int  writepipe;
 bool fullscreen;
 
-u8         details = 0;
-openfile * file    = NULL;
-
 //===== Support funtions =====
 
 void save_current_to_config() 
@@ -187,6 +239,40 @@ static void adjust_display_from_recent(recent_file_struct & recent)
   //buttons->resize(0, 0, 64, recent.height);
 }
 
+// Search mode of the current query: words looked up in the index,
+// or a "phrase" or /expression/ scanned for in the page text
+static bool scanning = false;
+static bool bad_expression = false;
+
+static void update_search()
+{
+  static char label[32];
+  bool complete;
+  const u32 count = scanning ? scan_hits(&complete) : search_hits(&complete);
+
+  if (!search_input->size())
+    label[0] = '\0';
+  else if (bad_expression)
+    snprintf(label, sizeof(label), "%s", _("Bad expression"));
+  else
+    snprintf(label, sizeof(label), complete ? _("%u hits") : _("%u+ hits"), count);
+
+  searchctr->label(label);
+}
+
+static void reloaded()
+{
+  // A stale message, from a reload replaced by a newer one
+  if (!core_reload_swap())
+    return;
+
+  char tmp[160];
+  snprintf(tmp, 160, "/ %u", ::file->pages);
+  pagectr->copy_label(tmp);
+
+  view->reloaded();
+}
+
 static void reader(FL_SOCKET fd, void *) 
 {
   // A thread has something to say to the main thread.
@@ -200,11 +286,75 @@ static void reader(FL_SOCKET fd, void *)
     case MSG_READY:
       fl_cursor(FL_CURSOR_DEFAULT);
     break;
+    case MSG_SEARCH:
+      update_search();
+    break;
+    case MSG_TRACE:
+      trace_dump();
+    break;
+    case MSG_RELOADED:
+      reloaded();
+    break;
     default:
       die(_("Unrecognized thread message\n"));
   }
 }
 
+// SIGUSR1, the dump is left to the main loop
+static void trace_signal(int)
+{
+  const u8 msg = MSG_TRACE;
+  const ssize_t ret = write(writepipe, &msg, 1);
+  (void) ret;
+}
+
+static u64  last_refresh    = 0;
+static bool refresh_pending = false;
+
+static void cb_refresh(void *)
+{
+  refresh_pending = false;
+  last_refresh    = msec();
+  view->redraw();
+}
+
+static void notified(FL_SOCKET, void *)
+{
+  // Pages were rendered. Refresh at most once per frame, and only if
+  // one of them is on screen.
+  if (!notify_drain(file->first_visible, file->last_visible) || refresh_pending)
+    return;
+
+  const u64 now = msec();
+  if (now - last_refresh >= FRAME_MS) {
+    cb_refresh(NULL);
+  }
+  else {
+    refresh_pending = true;
+    Fl::add_timeout((FRAME_MS - (now - last_refresh)) / 1000.0, cb_refresh);
+  }
+}
+
+static void cb_reload(void *)
+{
+  int err = 0;
+  const core_status status = core_reload(&err);
+
+  // Likely caught while being written, the end of the write tells again.
+  // Else the pages are being compared, see reloaded().
+  if (status != CORE_OK && details)
+    printf(_("Couldn't reload %s yet, error %d\n"), file->filename, err);
+}
+
+static void watched(FL_SOCKET, void *)
+{
+  // Builds write in several steps, wait for them to be done
+  if (watch_changed()) {
+    Fl::remove_timeout(cb_reload);
+    Fl::add_timeout(RELOAD_DELAY, cb_reload);
+  }
+}
+
 static void checkX() 
 {
   // Make sure everything's cool
@@ -226,6 +376,7 @@ void update_buttons()
 
             page_input->activate();
                pagectr->activate();
+          search_input->activate();
                zoombar->activate();
             page_moves->activate();
            page_moves2->activate();
@@ -237,6 +388,7 @@ void update_buttons()
     
             page_input->deactivate();
                pagectr->deactivate();
+          search_input->deactivate();
                zoombar->deactivate();
     my_trim_zone_group->deactivate();
      zoom_params_group->deactivate();
@@ -304,6 +456,10 @@ void cb_exit(Fl_Widget *, void *)
 {
   save_current_to_config();
   save_config();
+  if (tracing)
+    trace_dump();
+  latency_save();
+  record_stop();
   exit(0);
 }
 
@@ -406,6 +562,8 @@ static void cb_OpenRecent(Fl_Button *, void *)
   else 
     recent_select->clear();
 
+  prune_recent_files();
+
   recent_file_struct *rf = recent_files;
   while (rf != NULL) {
     recent_select->add(basename(rf->filename.c_str()));
@@ -495,6 +653,63 @@ static void cb_goto_page(Fl_Input * w, void*)
   update_buttons();
 }
 
+// Scan for the phrase or expression of the search field
+static void cb_scan(void *)
+{
+  Fl::remove_timeout(cb_scan);
+
+  const char * const query = search_input->value();
+  const u32 len = strlen(query);
+
+  // Drop the delimiters, the closing one is optional
+  char * const pattern = strdup(query + 1);
+  const char last = len > 1 ? query[len - 1] : 0;
+  if (last == query[0])
+    pattern[len - 2] = '\0';
+
+  bad_expression = !scan_start(pattern, query[0] == '/');
+  free(pattern);
+
+  update_search();
+}
+
+static void cb_search(Fl_Input * w, void *)
+{
+  if (Fl::event_key() == FL_Enter || Fl::event_key() == FL_KP_Enter) {
+    // Typed too fast for the scan to start, no page to go to yet
+    if (Fl::has_timeout(cb_scan)) {
+      cb_scan(NULL);
+      return;
+    }
+
+    // Next page holding the words
+    u32 hit;
+    const u32 page = view->get_yoff();
+    if (file->cache && (scanning ? scan_next(page, &hit) : search_next(page, &hit))) {
+      view->goto_page(hit);
+      update_buttons();
+    }
+    return;
+  }
+
+  const char * const query = w->value();
+  const u32 len = strlen(query);
+
+  scanning = len && (query[0] == '"' || query[0] == '/');
+  bad_expression = false;
+
+  // The hits of the previous query are stale either way
+  Fl::remove_timeout(cb_scan);
+  scan_stop();
+
+  if (scanning)
+    Fl::add_timeout(SCAN_DELAY, cb_scan);
+  else
+    search_set(query);
+
+  update_search();
+}
+
 static void cb_select_text(Fl_Widget * w, void *) 
 {
   selecting_trim_zone->value(0);
@@ -537,10 +752,21 @@ static void cb_trim_pages_browser(Fl_Widget *, void *)
   }
 }
 
+// Decoded apart, while the core starts and the display opens
+static void *decode_icons(void *)
+{
+  u32 i;
+  for (i = 0; i < ICON_COUNT; i++)
+    icons[i] = new Fl_PNG_Image(icondata[i].name, icondata[i].data, icondata[i].size);
+
+  return NULL;
+}
+
 //===== MAIN FUNCTION =====
 
 int main(int argc, char **argv) 
 {
+  startup_mark("main");
 
   srand(time(NULL));
 
@@ -551,14 +777,26 @@ int main(int argc, char **argv)
   #endif
 
   const struct option opts[] = {
-    { "details", 0, NULL, 'd' },
-    { "help",    0, NULL, 'h' },
-    { "version", 0, NULL, 'v' },
+    { "details",   0, NULL, 'd' },
+    { "help",      0, NULL, 'h' },
+    { "latency",   1, NULL, 'l' },
+    { "nice",      1, NULL, 'n' },
+    { "processes", 1, NULL, 'p' },
+    { "record",    1, NULL, 'r' },
+    { "replay",    1, NULL, 'R' },
+    { "startup",   0, NULL, 'S' },
+    { "threads",   1, NULL, 't' },
+    { "trace",     1, NULL, 'T' },
+    { "version",   0, NULL, 'v' },
+    { "watch",     0, NULL, 'w' },
+    { "text-layer", 0, NULL, 'x' },
     { NULL,      0, NULL,  0  }
   };
 
+  const char *replay = NULL;
+
   while (1) {
-    const int c = getopt_long(argc, argv, "dhv", opts, NULL);
+    const int c = getopt_long(argc, argv, "dhl:n:p:r:R:St:T:vwx", opts, NULL);
     if (c == -1)
       break;
 
@@ -566,6 +804,44 @@ int main(int argc, char **argv)
       case 'd':
         details++;
       break;
+      case 'l':
+        latency_output(optarg);
+      break;
+      case 'n':
+        render_nice = atoi(optarg);
+        if (render_nice < 0)
+          render_nice = 0;
+        if (render_nice > 19)
+          render_nice = 19;
+      break;
+      case 'p':
+        render_processes = atoi(optarg);
+        if (render_processes > 64)
+          render_processes = 64;
+      break;
+      case 'r':
+        record_start(optarg);
+      break;
+      case 'R':
+        replay = optarg;
+      break;
+      case 'S':
+        startup_timing = true;
+      break;
+      case 't':
+        render_threads = atoi(optarg);
+        if (render_threads > 256)
+          render_threads = 256;
+      break;
+      case 'T':
+        trace_start(optarg);
+      break;
+      case 'w':
+        live_reload = true;
+      break;
+      case 'x':
+        text_layer = true;
+      break;
       case 'v':
         printf("%s\n", PACKAGE_STRING);
         return 0;
@@ -575,30 +851,64 @@ int main(int argc, char **argv)
         printf(_("Usage: %s [options] file.pdf\n\n"
           "   -d --details    Print RAM, timing details (use twice for more)\n"
           "   -h --help   This help\n"
-          "   -v --version    Print version\n"),
+          "   -l --latency FILE   Write the frame and input latencies to FILE\n"
+          "                       on exit (F9 prints them at any time)\n"
+          "   -n --nice N         Nice value of the render threads, 0 to 19\n"
+          "                       (default: 10)\n"
+          "   -p --processes N    Render in N worker processes\n"
+          "   -r --record FILE    Record the view events to FILE\n"
+          "   -R --replay FILE    Play back the events of FILE as fast as\n"
+          "                       possible, print the timings and exit\n"
+          "   -S --startup        Print the time to the first page on screen\n"
+          "                       and exit\n"
+          "   -t --threads N      Use N render threads (default: one per CPU)\n"
+          "   -T --trace FILE     Record the render and draw times, written\n"
+          "                       to FILE as a Chrome trace on exit or SIGUSR1\n"
+          "   -v --version    Print version\n"
+          "   -w --watch          Reload the document when it changes, only\n"
+          "                       rendering the pages that changed\n"
+          "   -x --text-layer     Extract the text while rendering\n"),
           argv[0]);
         return 0;
       break;
     }
   }
 
+  // While single threaded, the worker processes fork from it
+  if (render_processes)
+    procrender_init();
+
+  pthread_t decoder;
+  if (pthread_create(&decoder, NULL, decode_icons, NULL))
+    die(_("Failed to create a thread\n"));
+
+  core_init();
+
+  fl_open_display();
+  startup_mark("display");
+
   Fl::scheme("gtk+");
-  Fl_File_Icon::load_system_icons();
 
   Fl::set_font(FL_NONO_FONT, "Nono Sans Regular");
 
-  file = (openfile *) xcalloc(1, sizeof(openfile));
   int ptmp[2];
   if (pipe(ptmp))
     die(_("Failed in pipe()\n"));
   writepipe = ptmp[1];
 
+  if (tracing)
+    signal(SIGUSR1, trace_signal);
+
   Fl::add_fd(ptmp[0], FL_READ, reader);
+  Fl::add_fd(notify_init(), FL_READ, notified);
+  if (live_reload)
+    Fl::add_fd(watch_init(), FL_READ, watched);
 
-  #define img(a) a, sizeof(a)
+  pthread_join(decoder, NULL);
+  startup_mark("icons");
 
-  fullscreen_image        = new Fl_PNG_Image("fullscreen.png",        img(view_fullscreen_png));
-  fullscreenreverse_image = new Fl_PNG_Image("fullscreenreverse.png", img(view_restore_png   ));
+  fullscreen_image        = icons[ICON_FULLSCREEN];
+  fullscreenreverse_image = icons[ICON_RESTORE];
 
   fullscreen = false;
 
@@ -608,19 +918,19 @@ int main(int argc, char **argv)
   { buttons = new Fl_Pack(0, 0, 64, 800);
     buttons->spacing(4);
     { Fl_Box * icon_box = new Fl_Box(0, 0, 64, 64);
-      icon_box->image(new Fl_PNG_Image("updf 64x64.png", img(updf_64x64_png))); }
+      icon_box->image(icons[ICON_UPDF64]); }
     { Fl_Button * hide_btn = new Fl_Button(0, 0, 64, 32);
       hide_btn->tooltip(_("Hide toolbar (F8)"));
       hide_btn->callback(cb_hide_show_buttons);
-      hide_btn->image(new Fl_PNG_Image("back.png", img(media_seek_backward_png))); }
+      hide_btn->image(icons[ICON_BACK]); }
     { Fl_Button * open_btn = new Fl_Button(0, 0, 64, 48);
       open_btn->tooltip(_("Open a new file"));
       open_btn->callback((Fl_Callback *)cb_Open);
-      open_btn->image(new Fl_PNG_Image("fileopen.png", img(document_open_png))); }
+      open_btn->image(icons[ICON_OPEN]); }
     { Fl_Button * recent_select_btn = new Fl_Button(0, 0, 64, 48);
       recent_select_btn->tooltip(_("Open a recent file"));
       recent_select_btn->callback((Fl_Callback *)cb_OpenRecent);
-      recent_select_btn->image(new Fl_PNG_Image("fileopen.png", img(emblem_documents_png))); }
+      recent_select_btn->image(icons[ICON_RECENT]); }
     { page_input = new Fl_Input(0, 0, 64, 24);
       page_input->value("0");
       page_input->callback((Fl_Callback *)cb_goto_page);
@@ -631,6 +941,16 @@ int main(int argc, char **argv)
       pagectr->box(FL_ENGRAVED_FRAME);
       pagectr->align(FL_ALIGN_WRAP);
       pagectr->labelsize(LABEL_SIZE); }
+    { search_input = new Fl_Input(0, 0, 64, 24);
+      search_input->tooltip(_("Search words, a \"phrase\" or a /regular expression/. "
+                              "Enter goes to the next page found"));
+      search_input->callback((Fl_Callback *)cb_search);
+      search_input->when(FL_WHEN_CHANGED | FL_WHEN_ENTER_KEY_ALWAYS);
+      search_input->textsize(LABEL_SIZE); }
+    { searchctr = new Fl_Box(0, 0, 64, 24, "");
+      searchctr->tooltip(_("Pages found"));
+      searchctr->box(FL_ENGRAVED_FRAME);
+      searchctr->labelsize(LABEL_SIZE); }
     { zoombar = new Fl_Input_Choice(0, 0, 64, 24);
       zoombar->tooltip(_("Preset zoom choices"));
       zoombar->callback((Fl_Callback *)cb_zoombar);
@@ -680,17 +1000,17 @@ int main(int argc, char **argv)
         { Fl_Button * o = new Fl_Button(0, 0, 32, 32);
           o->tooltip(_("Zoom in"));
           o->callback((Fl_Callback *)cb_zoomin);
-          o->image(new Fl_PNG_Image("zoomin.png", img(zoom_in_png))); }
+          o->image(icons[ICON_ZOOMIN]); }
         { Fl_Button * o = new Fl_Button(0, 0, 32, 32);
           o->tooltip(_("Zoom out"));
           o->callback((Fl_Callback *)cb_zoomout);
-          o->image(new Fl_PNG_Image("zoomout.png", img(zoom_out_png))); }
+          o->image(icons[ICON_ZOOMOUT]); }
         zooms->end();
         zooms->show(); }
       { selecting = new Fl_Light_Button(0, 0, 64, 38);
         selecting->tooltip(_("Select text"));
         selecting->align(FL_ALIGN_CENTER);
-        selecting->image(new Fl_PNG_Image("text.png", img(edit_select_all_png)));
+        selecting->image(icons[ICON_TEXT]);
         selecting->callback(cb_select_text); }
       { columns = new Fl_Choice(0, 0, 64, 24);
         columns->tooltip(_("Number of Columns"));
@@ -714,11 +1034,11 @@ int main(int argc, char **argv)
       { Fl_Button * o = new Fl_Button(0, 0, 32, 42);
         o->tooltip(_("Beginning of Document"));
         o->callback((Fl_Callback *)cb_page_top);
-        o->image(new Fl_PNG_Image("pagetop.png", img(go_top_png))); }
+        o->image(icons[ICON_TOP]); }
       { Fl_Button * o = new Fl_Button(0, 0, 32, 42);
         o->tooltip(_("Previous Page"));
         o->callback((Fl_Callback *)cb_page_up);
-        o->image(new Fl_PNG_Image("pageup.png", img(go_up_png))); }
+        o->image(icons[ICON_UP]); }
       page_moves->end();
       page_moves->show(); }
     { page_moves2 = new Fl_Pack(0, 0, 64, 42);
@@ -726,11 +1046,11 @@ int main(int argc, char **argv)
       { Fl_Button * o = new Fl_Button(0, 0, 32, 42);
         o->tooltip(_("End of Document"));
         o->callback((Fl_Callback *)cb_page_bottom);
-        o->image(new Fl_PNG_Image("pagebottom.png", img(go_bottom_png))); }
+        o->image(icons[ICON_BOTTOM]); }
       { Fl_Button * o = new Fl_Button(0, 0, 32, 42);
         o->tooltip(_("Next Page"));
         o->callback((Fl_Callback *)cb_page_down);
-        o->image(new Fl_PNG_Image("pagedown.png", img(go_down_png))); }
+        o->image(icons[ICON_DOWN]); }
       page_moves2->end();
       page_moves2->show(); }
     { fullscreen_btn = new Fl_Button(0, 0, 64, 38);
@@ -738,29 +1058,12 @@ int main(int argc, char **argv)
       fullscreen_btn->callback((Fl_Callback *)cb_fullscreen);
       fullscreen_btn->tooltip(_("Enter Full Screen")); }
 
-    #if DEBUGGING && 0
-      { debug1 = new Fl_Box(0, 0, 64, 32, "");
-        debug1->align(FL_ALIGN_WRAP); }
-      { debug2 = new Fl_Box(0, 0, 64, 32, "");
-        debug2->align(FL_ALIGN_WRAP); }
-      { debug3 = new Fl_Box(0, 0, 64, 32, "");
-        debug3->align(FL_ALIGN_WRAP); }
-      { debug4 = new Fl_Box(0, 0, 64, 32, "");
-        debug4->align(FL_ALIGN_WRAP); }
-      { debug5 = new Fl_Box(0, 0, 64, 32, "");
-        debug5->align(FL_ALIGN_WRAP); }
-      { debug6 = new Fl_Box(0, 0, 64, 32, "");
-        debug6->align(FL_ALIGN_WRAP); }
-      { debug7 = new Fl_Box(0, 0, 64, 32, "");
-        debug7->align(FL_ALIGN_WRAP); }
-    #endif
-
     { Fl_Box * fill_box = new Fl_Box(0, 0, 64, 0, "");
       fill_box->box(FL_ENGRAVED_FRAME);
       buttons->resizable(fill_box); }
     { Fl_Button * exitbtn = new Fl_Button(0, 0, 64, 38);
       exitbtn->callback((Fl_Callback *)cb_exit);
-      exitbtn->image(new Fl_PNG_Image("exit.png", img(application_exit_png)));
+      exitbtn->image(icons[ICON_EXIT]);
       exitbtn->tooltip(_("Exit")); }
     buttons->end();
     buttons->show(); 
@@ -783,19 +1086,14 @@ int main(int argc, char **argv)
   win->size_range(500, 500);
   win->end();
 
-  Fl_PNG_Image updf_icon("updf-128x128.png", img(updf_128x128_png));
-  win->icon(&updf_icon);
+  win->icon(icons[ICON_UPDF128]);
 
-  fl_open_display();
   win->show();
+  startup_mark("window");
   checkX();
 
   #undef img
 
-  if (lzo_init() != LZO_E_OK) {
-    die(_("LZO init failed\n"));
-  }
-
   // Set the width to half of the screen, 90% of height
   // win->size(Fl::w() * 0.4f, Fl::h() * 0.9f);
 
@@ -803,6 +1101,10 @@ int main(int argc, char **argv)
 
   update_buttons();
 
+  // The last document is reopened, it has to be there
+  if (optind >= argc)
+    prune_recent_files();
+
   if (loadfile(optind < argc ? argv[optind] : NULL, recent_files)) {
     file_loaded();
     adjust_display_from_recent(*recent_files);
@@ -810,8 +1112,15 @@ int main(int argc, char **argv)
   else {
     update_buttons();
   }
+  startup_mark("document");
 
   view->take_focus();
 
+  if (replay) {
+    if (!file->cache)
+      die(_("Nothing to replay on, no document opened\n"));
+    replay_start(replay, win, view);
+  }
+
   return Fl::run();
 }
@@ -21,11 +21,6 @@ Modifications Copyright (C) 2016 Guy Turcotte
 #define MAIN_H
 
 #include <math.h>
-#include <pthread.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-#include <lzo/lzo1x.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrender.h>
 
@@ -44,67 +39,13 @@ Modifications Copyright (C) 2016 Guy Turcotte
 #include <FL/Fl_File_Icon.H>
 #include <FL/x.H>
 
-#include <PDFDoc.h>
-
-#define DEBUGGING 1
-
+#include "core.h"
 #include "globals.h"
-#include "autoconfig.h"
-#include "gettext.h"
-#include "lrtypes.h"
-#include "macros.h"
 #include "config.h"
 #include "view.h"
-#include "helpers.h"
-
-extern Fl_Box * debug1, 
-              * debug2, 
-              * debug3, 
-              * debug4, 
-              * debug5, 
-              * debug6, 
-              * debug7;
-
-extern u8 details;
-
-extern int writepipe;
 
 bool loadfile(const char *, recent_file_struct * recent_files);
 
-const int MAX_COLUMNS_COUNT = 5;
-
-struct cachedpage {
-  u8  * data;
-  u32   size;
-  u32   uncompressed;
-
-  u32   w, h;
-  u16   left, right, top, bottom;
-
-  bool  ready;
-};
-
-enum msg {
-  MSG_REFRESH = 0,
-  MSG_READY
-};
-
-struct openfile {
-  char       * filename;
-  cachedpage * cache;
-  PDFDoc     * pdf;
-  u32          maxw, maxh;
-
-  u32          pages;
-
-  u32          first_visible;
-  u32          last_visible;
-
-  pthread_t    tid;
-};
-
-extern openfile * file;
-
 void cb_hide_show_buttons(Fl_Widget *, void *);
 void update_buttons();
 
@@ -0,0 +1,253 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// updf-microbench: time the pixel kernels of the page pipeline one by
+// one, on real page bitmaps, and report ns per pixel as JSON on stdout.
+// The best of the repetitions is kept.
+
+#include "core.h"
+#include <getopt.h>
+#include <locale.h>
+#include <time.h>
+#include <SplashOutputDev.h>
+#include <splash/SplashBitmap.h>
+
+enum kernel {
+  K_NONWHITE = 0,   // nonwhite() over every pixel
+  K_MARGINS,        // getmargins()
+  K_TRIM,           // The trimming copy of store()
+  K_COMPRESS,       // LZO compression of the trimmed copy
+  K_DECOMPRESS,     // LZO decompression, as docache() does
+  K_COUNT
+};
+
+static const char * const names[K_COUNT] = {
+  "nonwhite", "margins", "trim", "compress", "decompress"
+};
+
+static u64 nsnow() {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static u32 countnonwhite(const u8 * const src, const u32 w, const u32 h,
+                         const u32 rowsize) {
+
+  u32 i, j, n = 0;
+  for (j = 0; j < h; j++) {
+    const u8 * const row = src + j * rowsize;
+    for (i = 0; i < w; i++) {
+      if (nonwhite(row + i * 4))
+        n++;
+    }
+  }
+
+  return n;
+}
+
+// Run every kernel reps times on one bitmap, keep the fastest of each
+static void kernels(const u8 * const src, const u32 w, const u32 h,
+                    const u32 rowsize, const u32 reps, u64 *best,
+                    u32 *dark, u32 *trimmed, u32 *packed) {
+
+  u32 r, k;
+  for (k = 0; k < K_COUNT; k++)
+    best[k] = ~0ULL;
+
+  for (r = 0; r < reps; r++) {
+    u64 t[K_COUNT + 1];
+
+    t[0] = nsnow();
+    *dark = countnonwhite(src, w, h, rowsize);
+    t[1] = nsnow();
+
+    u32 minx = 0, miny = 0, maxx = w - 1, maxy = h - 1;
+    getmargins(src, w, h, rowsize, &minx, &maxx, &miny, &maxy);
+    t[2] = nsnow();
+
+    const u32 trimw = maxx - minx + 1;
+    const u32 trimh = maxy - miny + 1;
+    u8 * const trim = trimcopy(src, rowsize, minx, miny, trimw, trimh);
+    t[3] = nsnow();
+
+    u32 outlen;
+    u8 * const data = compresspage(trim, trimw * trimh * 4, &outlen);
+    t[4] = nsnow();
+
+    // Into the copy, it has the right size
+    lzo_uint dstsize = trimw * trimh * 4;
+    const int ret = lzo1x_decompress(data, outlen, trim, &dstsize, NULL);
+    t[5] = nsnow();
+
+    if (ret != LZO_E_OK || dstsize != trimw * trimh * 4)
+      die(_("Error decompressing\n"));
+
+    free(trim);
+    free(data);
+
+    *trimmed = trimw * trimh;
+    *packed = outlen;
+
+    for (k = 0; k < K_COUNT; k++) {
+      if (t[k + 1] - t[k] < best[k])
+        best[k] = t[k + 1] - t[k];
+    }
+  }
+}
+
+static bool bench(const char *name, const u32 samples, const u32 reps,
+                  const bool first) {
+
+  GooString gooname(name);
+  PDFDoc * const pdf = new PDFDoc(&gooname);
+  if (!pdf->isOk()) {
+    err(_("%s: PDF error %d\n"), name, pdf->getErrorCode());
+    delete pdf;
+    return false;
+  }
+
+  const u32 pages = pdf->getNumPages();
+  const u32 n = samples && samples < pages ? samples : pages;
+
+  // Whole-document ns and pixels of each kernel
+  u64 ns[K_COUNT] = { 0 }, px[K_COUNT] = { 0 };
+  u32 s, k;
+
+  printf("%s  {\"file\": ", first ? "" : ",\n");
+  jsonstr(name);
+  printf(", \"pages\": %u, \"samples\": [", pages);
+
+  for (s = 0; s < n; s++) {
+    // Spread over the document, for a mix of densities
+    const u32 page = (u64) s * pages / n;
+
+    SplashColor white = { 255, 255, 255 };
+    SplashOutputDev * const splash =
+      new SplashOutputDev(splashModeXBGR8, 4, false, white);
+    splash->startDoc(pdf);
+    pdf->displayPage(splash, page + 1, RENDER_DPI, RENDER_DPI, 0, true, false, false);
+
+    SplashBitmap * const bm = splash->takeBitmap();
+    const u32 w = bm->getWidth(), h = bm->getHeight();
+
+    u64 best[K_COUNT];
+    u32 dark, trimmed, packed;
+    kernels(bm->getDataPtr(), w, h, bm->getRowSize(), reps, best,
+            &dark, &trimmed, &packed);
+
+    delete bm;
+    delete splash;
+
+    // The scans see the whole bitmap, the rest only the trimmed part
+    const u64 pixels[K_COUNT] = { (u64) w * h, (u64) w * h, trimmed,
+                                  trimmed, trimmed };
+
+    printf("%s\n    {\"page\": %u, \"w\": %u, \"h\": %u, \"density\": %.4f, "
+           "\"trimmed\": %u, \"ratio\": %.4f,\n     \"ns_per_pixel\": {",
+           s ? "," : "", page + 1, w, h, dark / (float) (w * h), trimmed,
+           packed / (trimmed * 4.0f));
+
+    for (k = 0; k < K_COUNT; k++) {
+      printf("%s\"%s\": %.4f", k ? ", " : "", names[k],
+             best[k] / (double) pixels[k]);
+      ns[k] += best[k];
+      px[k] += pixels[k];
+    }
+    printf("}}");
+    fflush(stdout);
+  }
+
+  printf("\n   ],\n   \"ns_per_pixel\": {");
+  for (k = 0; k < K_COUNT; k++)
+    printf("%s\"%s\": %.4f", k ? ", " : "", names[k],
+           px[k] ? ns[k] / (double) px[k] : 0.0);
+  printf("}}");
+
+  delete pdf;
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+
+  // Messages only, the numbers must stay JSON
+  #if ENABLE_NLS
+    setlocale(LC_MESSAGES, "");
+    bindtextdomain("updf", LOCALEDIR);
+    textdomain("updf");
+  #endif
+
+  u32 samples = 16, reps = 5;
+
+  const struct option opts[] = {
+    { "pages",   1, NULL, 'n' },
+    { "repeat",  1, NULL, 'r' },
+    { "help",    0, NULL, 'h' },
+    { NULL,      0, NULL,  0  }
+  };
+
+  while (1) {
+    const int c = getopt_long(argc, argv, "hn:r:", opts, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'n':
+        samples = atoi(optarg);
+      break;
+      case 'r':
+        reps = atoi(optarg);
+        if (reps < 1)
+          reps = 1;
+      break;
+      case 'h':
+      default:
+        printf(_("Usage: %s [options] file.pdf...\n\n"
+          "   -h --help   This help\n"
+          "   -n --pages N        Measure N pages spread over each document,\n"
+          "                       0 for all (default: 16)\n"
+          "   -r --repeat N       Keep the best of N runs (default: 5)\n"),
+          argv[0]);
+        return 0;
+      break;
+    }
+  }
+
+  if (optind >= argc)
+    die(_("No document given, see %s --help\n"), argv[0]);
+
+  // The compressor and poppler, the render threads stay idle
+  core_init();
+
+  printf("{\"kernels\": [\n");
+
+  bool first = true;
+  u32 failed = 0;
+  int i;
+  for (i = optind; i < argc; i++) {
+    if (bench(argv[i], samples, reps, first))
+      first = false;
+    else
+      failed++;
+  }
+
+  printf("\n]}\n");
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "notify.h"
+#include <sys/eventfd.h>
+
+// Must be a power of two
+#define NOTIFY_RING 1024
+
+// Bounded multi-producer ring. A slot's sequence tells whose turn it is:
+// pos for the producer of pos, pos + 1 once filled for the consumer.
+struct slot {
+  std::atomic<u32> seq;
+  u32              page;
+};
+
+static slot             ring[NOTIFY_RING];
+static std::atomic<u32> head(0);          // Producers
+static u32              tail = 0;         // UI thread only
+static std::atomic<bool> armed(false);    // A wakeup is pending
+static std::atomic<bool> overflow(false); // Pages were lost, refresh anyway
+static int              efd = -1;
+
+int notify_init() {
+
+  u32 i;
+  for (i = 0; i < NOTIFY_RING; i++)
+    ring[i].seq.store(i, std::memory_order_relaxed);
+
+  efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd < 0)
+    die(_("Failed in eventfd()\n"));
+
+  return efd;
+}
+
+static bool push(const u32 page) {
+
+  u32 pos = head.load(std::memory_order_relaxed);
+  slot *s;
+
+  while (true) {
+    s = &ring[pos & (NOTIFY_RING - 1)];
+    const s32 dif = s->seq.load(std::memory_order_acquire) - pos;
+
+    if (dif == 0) {
+      if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if (dif < 0) {
+      return false;
+    }
+    else {
+      pos = head.load(std::memory_order_relaxed);
+    }
+  }
+
+  s->page = page;
+  s->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+static bool pop(u32 * const page) {
+
+  slot * const s = &ring[tail & (NOTIFY_RING - 1)];
+  const s32 dif = s->seq.load(std::memory_order_acquire) - (tail + 1);
+
+  if (dif < 0)
+    return false;
+
+  *page = s->page;
+  s->seq.store(tail + NOTIFY_RING, std::memory_order_release);
+  tail++;
+  return true;
+}
+
+void notify_page(const u32 page) {
+
+  if (!push(page))
+    overflow.store(true, std::memory_order_relaxed);
+
+  // Only the first page since the last drain wakes the UI up
+  if (!armed.exchange(true)) {
+    const u64 one = 1;
+    swrite(efd, &one, sizeof(u64));
+  }
+}
+
+bool notify_drain(const u32 first, const u32 last) {
+
+  u64 count;
+  if (read(efd, &count, sizeof(u64)) < 0 && errno != EAGAIN)
+    die(_("Failed reading eventfd\n"));
+
+  // Re-arm before looking, a page published from now on wakes us again
+  armed.store(false);
+
+  bool visible = overflow.exchange(false);
+  u32 page;
+
+  while (pop(&page)) {
+    if (page >= first && page <= last)
+      visible = true;
+  }
+
+  return visible;
+}
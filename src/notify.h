@@ -0,0 +1,38 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include "lrtypes.h"
+
+// Page-ready notifications from the render threads to the UI.
+//
+// The pages are queued in a lock-free ring and a single eventfd wakeup
+// covers all the pages queued until the UI drains them, so that a burst
+// of completions costs one wakeup instead of one per page.
+
+// Returns the descriptor the UI has to watch
+int  notify_init();
+
+// Called by the render threads, never blocks
+void notify_page(const u32 page);
+
+// Called by the UI when the descriptor is readable. True if one of the
+// pages in [first, last] is now ready.
+bool notify_drain(const u32 first, const u32 last);
+
+#endif
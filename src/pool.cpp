@@ -0,0 +1,211 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+static __thread s32 pool_worker_id = -1;
+
+struct worker_start {
+  threadpool * tp;
+  u32          id;
+};
+
+threadpool::threadpool(u32 count, s32 nice): count(count ? count : 1),
+    nice(nice), next(0), queued(0), stopping(false)
+{
+  pthread_mutex_init(&lock, NULL);
+  pthread_mutex_init(&urgent.lock, NULL);
+  pthread_cond_init(&wakeup, NULL);
+  pthread_cond_init(&idle, NULL);
+
+  tids    = (pthread_t *) xcalloc(this->count, sizeof(pthread_t));
+  current = (u32 *) xcalloc(this->count, sizeof(u32));
+  queues  = new worker_queue[this->count];
+
+  u32 i;
+  for (i = 0; i < this->count; i++)
+    pthread_mutex_init(&queues[i].lock, NULL);
+
+  for (i = 0; i < this->count; i++) {
+    worker_start * const ws = (worker_start *) xmalloc(sizeof(worker_start));
+    ws->tp = this;
+    ws->id = i;
+    if (pthread_create(&tids[i], NULL, run, ws))
+      die(_("Failed to start render thread %u\n"), i);
+  }
+}
+
+threadpool::~threadpool()
+{
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_broadcast(&wakeup);
+  pthread_mutex_unlock(&lock);
+
+  u32 i;
+  for (i = 0; i < count; i++)
+    pthread_join(tids[i], NULL);
+
+  for (i = 0; i < count; i++)
+    pthread_mutex_destroy(&queues[i].lock);
+  pthread_mutex_destroy(&urgent.lock);
+
+  delete [] queues;
+  free(current);
+  free(tids);
+
+  pthread_cond_destroy(&idle);
+  pthread_cond_destroy(&wakeup);
+  pthread_mutex_destroy(&lock);
+}
+
+s32 threadpool::worker_id()
+{
+  return pool_worker_id;
+}
+
+u32 threadpool::busy() const
+{
+  u32 i, n = 0;
+  for (i = 0; i < count; i++) {
+    if (__atomic_load_n(&current[i], __ATOMIC_RELAXED))
+      n++;
+  }
+  return n;
+}
+
+void threadpool::submit(task_func func, void * arg, u32 doc, bool urgent)
+{
+  const pool_task task = { func, arg, doc };
+  worker_queue * const q = urgent ? &this->urgent :
+                           &queues[__sync_fetch_and_add(&next, 1) % count];
+
+  // Counted before it can be taken, or take() could decrement first and
+  // wrap the count, leaving the idle workers spinning until it lands
+  pthread_mutex_lock(&lock);
+  __sync_fetch_and_add(&queued, 1);
+
+  pthread_mutex_lock(&q->lock);
+  if (urgent)
+    q->tasks.push_front(task);
+  else
+    q->tasks.push_back(task);
+  pthread_mutex_unlock(&q->lock);
+
+  pthread_cond_signal(&wakeup);
+  pthread_mutex_unlock(&lock);
+}
+
+// Drop the queued tasks of a document, and wait for its running ones.
+void threadpool::cancel(u32 doc)
+{
+  u32 i;
+  for (i = 0; i <= count; i++) {
+    worker_queue * const q = i < count ? &queues[i] : &urgent;
+
+    pthread_mutex_lock(&q->lock);
+    std::deque<pool_task>::iterator it = q->tasks.begin();
+    while (it != q->tasks.end()) {
+      if (it->doc == doc) {
+        it = q->tasks.erase(it);
+        __sync_fetch_and_sub(&queued, 1);
+      }
+      else {
+        it++;
+      }
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < count; i++) {
+    while ((s32) i != pool_worker_id &&
+           __atomic_load_n(&current[i], __ATOMIC_ACQUIRE) == doc)
+      pthread_cond_wait(&idle, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+// The urgent queue first, then the own one, then steal from the others.
+// The document is marked running before the queue lock is released, so
+// that cancel() can't miss it.
+bool threadpool::take(u32 id, pool_task & task)
+{
+  u32 i;
+  for (i = 0; i <= count; i++) {
+    const u32 victim = (id + count + i - 1) % count;
+    worker_queue * const q = i ? &queues[victim] : &urgent;
+
+    pthread_mutex_lock(&q->lock);
+    if (!q->tasks.empty()) {
+      if (!i || victim == id) {
+        task = q->tasks.front();
+        q->tasks.pop_front();
+      }
+      else {
+        task = q->tasks.back();
+        q->tasks.pop_back();
+      }
+      __atomic_store_n(&current[id], task.doc, __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&q->lock);
+
+      __sync_fetch_and_sub(&queued, 1);
+      return true;
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  return false;
+}
+
+void * threadpool::run(void * arg)
+{
+  worker_start * const ws = (worker_start *) arg;
+  threadpool * const tp = ws->tp;
+  const u32 id = ws->id;
+  free(ws);
+
+  pool_worker_id = id;
+
+  // Linux applies the nice value per thread
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), tp->nice);
+
+  while (true) {
+    pthread_mutex_lock(&tp->lock);
+    while (!tp->stopping && !__atomic_load_n(&tp->queued, __ATOMIC_ACQUIRE))
+      pthread_cond_wait(&tp->wakeup, &tp->lock);
+    const bool stopping = tp->stopping;
+    pthread_mutex_unlock(&tp->lock);
+
+    if (stopping)
+      break;
+
+    pool_task task;
+    if (!tp->take(id, task))
+      continue;
+
+    task.func(task.arg);
+
+    pthread_mutex_lock(&tp->lock);
+    __atomic_store_n(&tp->current[id], 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&tp->idle);
+    pthread_mutex_unlock(&tp->lock);
+  }
+
+  return NULL;
+}
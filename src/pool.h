@@ -0,0 +1,88 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <deque>
+
+#include "lrtypes.h"
+
+// Default nice value of the pool threads, so that rendering never
+// competes with the user interface. See render_nice.
+#define POOL_NICE 10
+
+typedef void (*task_func)(void * arg);
+
+struct pool_task {
+  task_func func;
+  void    * arg;
+  u32       doc;     // Document the task works on
+};
+
+// Long-lived work-stealing thread pool, shared by all the opened documents.
+//
+// Each worker owns a queue it takes tasks from the front of. When it is
+// empty, it steals from the back of the other queues. Urgent tasks go to
+// the front of a shared queue that every worker empties first, so that
+// the latest ones run before anything else. Tasks are tagged with
+// the document they belong to, so that all the work of a closed document
+// can be dropped with cancel().
+class threadpool {
+public:
+  threadpool(u32 count, s32 nice = POOL_NICE);
+  ~threadpool();
+
+  void submit(task_func func, void * arg, u32 doc, bool urgent = false);
+  void cancel(u32 doc);
+
+  inline u32 threads() const { return count; }
+  inline u32 pending() const { return __atomic_load_n(&queued, __ATOMIC_RELAXED); }
+  u32  busy() const;
+
+  // Index of the calling pool thread, -1 if not called from the pool
+  static s32 worker_id();
+
+private:
+  struct worker_queue {
+    pthread_mutex_t       lock;
+    std::deque<pool_task> tasks;
+  };
+
+  static void * run(void * arg);
+  bool take(u32 id, pool_task & task);
+
+  u32            count;
+  s32            nice;
+  u32            next;
+  pthread_t    * tids;
+  worker_queue * queues;
+  worker_queue   urgent;    // Ahead of all the others, newest first
+  u32          * current;   // Document of the running task, per worker,
+                            // only accessed through __atomic builtins
+
+  pthread_mutex_t lock;     // Sleeping and waking up
+  pthread_cond_t  wakeup;
+  pthread_cond_t  idle;
+  u32             queued;   // Counted before the task is pushed, only
+                            // accessed through __atomic/__sync builtins
+  bool            stopping;
+};
+
+extern threadpool * pool;
+
+#endif
@@ -0,0 +1,621 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "procrender.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <GlobalParams.h>
+
+// Address space reserved for the compressed pages. Only the pages
+// actually written are backed by memory.
+#if __SIZEOF_POINTER__ == 8
+  static const u64 ARENA_SIZE = 4ULL * 1024 * 1024 * 1024;
+#else
+  static const u64 ARENA_SIZE = 512 * 1024 * 1024;
+#endif
+
+// Data starts after the allocation counter
+#define ARENA_DATA 64
+
+// Attempts before a page is given up and shown blank
+#define MAX_ATTEMPTS 2
+
+enum job_state {
+  PS_TODO = 0,
+  PS_INFLIGHT,
+  PS_DONE
+};
+
+enum result_status {
+  RES_OK = 0,
+  RES_FULL
+};
+
+// Sent by a worker for each page, smaller than PIPE_BUF
+struct procresult {
+  u64 offset;
+  u32 page;
+  u32 status;
+  u32 size;
+  u32 uncompressed;
+  u32 w, h;
+  u16 left, right, top, bottom;
+};
+
+struct procworker {
+  pid_t pid;
+  int   pidfd;   // Signals this very process, -1 if the kernel has none
+  int   jobfd;   // The page to render is written here
+  int   resfd;   // Results are read from here
+  s32   page;    // Page being rendered, -1 if idle
+};
+
+// Descriptors handed to the zygote for each worker
+enum spawn_fd {
+  SF_DOC = 0,    // The document content
+  SF_ARENA,
+  SF_JOB,        // Read end of the job pipe
+  SF_RES,        // Write end of the result pipe
+  SF_COUNT
+};
+
+// Socket to the zygote, -1 if it was not started
+static int zygote_fd = -1;
+
+static void worker(const int * const fds, const u64 size) NORETURN_FUNC;
+
+static void worker(const int * const fds, const u64 size) {
+
+  // Forked from the zygote, which runs at the priority of the app
+  setpriority(PRIO_PROCESS, 0, render_nice);
+
+  u8 * const arena = (u8 *) mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fds[SF_ARENA], 0);
+  if (arena == MAP_FAILED)
+    _exit(1);
+
+  u64 * const used = (u64 *) arena;
+
+  const u8 * const data = (const u8 *) mmap(NULL, size, PROT_READ, MAP_PRIVATE,
+                                            fds[SF_DOC], 0);
+  if (data == MAP_FAILED)
+    _exit(1);
+
+  const int jobfd = fds[SF_JOB];
+  const int resfd = fds[SF_RES];
+
+  // The zygote was forked before core_init()
+  if (!globalParams)
+    globalParams = new GlobalParams;
+  if (!file)
+    file = new openfile();
+
+  PDFDoc * const pdf = memdoc(data, size);
+  if (!pdf->isOk())
+    _exit(1);
+
+  u32 page;
+  while (sread(jobfd, &page, sizeof(u32)) == sizeof(u32)) {
+
+    cachedpage cp{};
+    renderpage(pdf, page, &cp, false);
+
+    procresult res;
+    memset(&res, 0, sizeof(procresult));
+
+    res.page         = page;
+    res.size         = cp.size;
+    res.uncompressed = cp.uncompressed;
+    res.w            = cp.w;
+    res.h            = cp.h;
+    res.left         = cp.left;
+    res.right        = cp.right;
+    res.top          = cp.top;
+    res.bottom       = cp.bottom;
+
+    // Other workers allocate concurrently
+    const u64 len = (cp.size + 7) & ~7ULL;
+    res.offset = ARENA_DATA + __sync_fetch_and_add(used, len);
+
+    if (res.offset + len > ARENA_SIZE) {
+      res.status = RES_FULL;
+    }
+    else {
+      memcpy(arena + res.offset, cp.data, cp.size);
+      res.status = RES_OK;
+    }
+    free(cp.data);
+
+    if (swrite(resfd, &res, sizeof(procresult)) != sizeof(procresult))
+      break;
+  }
+
+  _exit(0);
+}
+
+// Send len bytes of buf along with the count descriptors of fds
+static bool sendfds(const int sock, const void * const buf, const u32 len,
+                    const int * const fds, const u32 count) {
+
+  char control[CMSG_SPACE(SF_COUNT * sizeof(int))];
+  memset(control, 0, sizeof(control));
+
+  struct iovec iov;
+  iov.iov_base = (void *) buf;
+  iov.iov_len  = len;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+
+  if (count) {
+    msg.msg_control    = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+    struct cmsghdr * const cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+  }
+
+  ssize_t ret;
+  do {
+    ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (ret < 0 && errno == EINTR);
+
+  return ret == (ssize_t) len;
+}
+
+// Receive what sendfds() sent: the number of descriptors, up to max,
+// -1 when the other side is gone
+static s32 recvfds(const int sock, void * const buf, const u32 len,
+                   int * const fds, const u32 max) {
+
+  char control[CMSG_SPACE(SF_COUNT * sizeof(int))];
+
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len  = len;
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t ret;
+  do {
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret != (ssize_t) len || (msg.msg_flags & MSG_CTRUNC))
+    return -1;
+
+  struct cmsghdr * const cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg)
+    return 0;
+  if (cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len < CMSG_LEN(0))
+    return -1;
+
+  const u32 count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  if (count > max)
+    return -1;
+
+  memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+  return count;
+}
+
+// A descriptor of the process that can't come to name another one, even
+// once it is reaped and its pid reused. -1 before Linux 5.3.
+static int pidopen(const pid_t pid) {
+
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void) pid;
+  return -1;
+#endif
+}
+
+static void pidkill(const int pidfd) {
+
+#ifdef SYS_pidfd_send_signal
+  syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+#else
+  (void) pidfd;
+#endif
+}
+
+// The zygote's, reaps the workers as they exit
+static void reapall(int) {
+
+  const int saved = errno;
+  while (waitpid(-1, NULL, WNOHANG) > 0);
+  errno = saved;
+}
+
+static void zygote(const int sock) NORETURN_FUNC;
+
+// Fork a worker for each request of the app, answering with its pid and
+// a pidfd of it. Single threaded, so the workers don't inherit a lock
+// held by a thread that does not exist in them.
+static void zygote(const int sock) {
+
+  // The app watches the result pipes, the workers are reaped here. Not
+  // between a fork and its pidfd, which would then name another process
+  // if the pid was reused.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = reapall;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+
+  while (1) {
+    u64 size;
+    int fds[SF_COUNT];
+    if (recvfds(sock, &size, sizeof(u64), fds, SF_COUNT) != SF_COUNT)
+      _exit(0);
+
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+      close(sock);
+      signal(SIGCHLD, SIG_DFL);
+      sigprocmask(SIG_UNBLOCK, &chld, NULL);
+      worker(fds, size);
+    }
+
+    const int pidfd = pid > 0 ? pidopen(pid) : -1;
+    sigprocmask(SIG_UNBLOCK, &chld, NULL);
+
+    // Only the worker may hold its pipes, or its death would go unseen
+    u32 i;
+    for (i = 0; i < SF_COUNT; i++)
+      close(fds[i]);
+
+    const s32 ret = pid;
+    const bool sent = sendfds(sock, &ret, sizeof(s32), &pidfd, pidfd >= 0);
+    if (pidfd >= 0)
+      close(pidfd);
+    if (!sent)
+      _exit(0);
+  }
+}
+
+void procrender_init() {
+
+  compress_init();
+
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+    return;
+
+  const pid_t pid = fork();
+  if (pid < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return;
+  }
+
+  if (pid == 0) {
+    close(sv[0]);
+    zygote(sv[1]);
+  }
+
+  close(sv[1]);
+  zygote_fd = sv[0];
+}
+
+static bool spawn(procworker * const w, const int docfd, const u64 size,
+                  const int arenafd) {
+
+  int job[2], res[2];
+
+  if (pipe(job))
+    return false;
+  if (pipe(res)) {
+    close(job[0]);
+    close(job[1]);
+    return false;
+  }
+
+  const int fds[SF_COUNT] = { docfd, arenafd, job[0], res[1] };
+  const bool sent = sendfds(zygote_fd, &size, sizeof(u64), fds, SF_COUNT);
+
+  // The zygote has its copies, then the worker
+  close(job[0]);
+  close(res[1]);
+
+  s32 pid = -1;
+  int pidfd = -1;
+  const s32 got = sent ? recvfds(zygote_fd, &pid, sizeof(s32), &pidfd, 1) : -1;
+  if (got < 0 || pid <= 0) {
+    if (got > 0)
+      close(pidfd);
+    close(job[1]);
+    close(res[0]);
+    return false;
+  }
+
+  w->pid   = pid;
+  w->pidfd = got ? pidfd : -1;
+  w->jobfd = job[1];
+  w->resfd = res[0];
+  w->page  = -1;
+
+  return true;
+}
+
+// The zygote reaps the workers, closing the job pipe has them exit.
+// A stuck one is killed through its pidfd, never by pid: the zygote may
+// have reaped it already, and the pid be another process now. Without a
+// pidfd, it exits once done with its page.
+static void reap(procworker * const w, const bool kill_it) {
+
+  if (w->pid <= 0) return;
+
+  if (w->pidfd >= 0) {
+    if (kill_it)
+      pidkill(w->pidfd);
+    close(w->pidfd);
+  }
+
+  close(w->jobfd);
+  close(w->resfd);
+
+  w->pid   = 0;
+  w->pidfd = -1;
+  w->page  = -1;
+}
+
+// A copy of the document the workers can map, file->data may be
+// private to this process
+static int docmemfd() {
+
+  const int fd = memfd_create("updf-doc", 0);
+  if (fd < 0)
+    return -1;
+
+  u64 done = 0;
+  while (done < file->size) {
+    const ssize_t ret = write(fd, file->data + done, file->size - done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      close(fd);
+      return -1;
+    }
+    done += ret;
+  }
+
+  return fd;
+}
+
+// Next page to render, the ones the user is looking at first.
+static s32 pickpage(const u8 * const state, u32 * const next, const u32 ahead) {
+
+  const u32 first = file->first_visible.load(std::memory_order_relaxed);
+  u32 i;
+
+  for (i = first; i < file->pages && i < first + ahead; i++) {
+    if (state[i] == PS_TODO)
+      return i;
+  }
+
+  for (; *next < file->pages; (*next)++) {
+    if (state[*next] == PS_TODO)
+      return *next;
+  }
+
+  return -1;
+}
+
+bool procrender(const u32 count, const std::atomic<bool> * const abort,
+                void (*fallback)(const u32 page)) {
+
+  if (zygote_fd < 0)
+    return false;
+
+  const int arenafd = memfd_create("updf-arena", 0);
+  if (arenafd < 0)
+    return false;
+
+  if (ftruncate(arenafd, ARENA_SIZE)) {
+    close(arenafd);
+    return false;
+  }
+
+  // This side only reads what the workers wrote
+  u8 * const arena = (u8 *) mmap(NULL, ARENA_SIZE, PROT_READ, MAP_SHARED,
+                                 arenafd, 0);
+  if (arena == MAP_FAILED) {
+    close(arenafd);
+    return false;
+  }
+
+  const int docfd = docmemfd();
+  if (docfd < 0) {
+    munmap(arena, ARENA_SIZE);
+    close(arenafd);
+    return false;
+  }
+
+  // A worker may die with its job pipe still being written to
+  signal(SIGPIPE, SIG_IGN);
+
+  procworker * const workers = (procworker *) xcalloc(count, sizeof(procworker));
+  struct pollfd * const fds = (struct pollfd *) xcalloc(count, sizeof(struct pollfd));
+  u8 * const state    = (u8 *) xcalloc(file->pages, 1);
+  u8 * const attempts = (u8 *) xcalloc(file->pages, 1);
+
+  u32 i, alive = 0;
+  for (i = 0; i < count; i++) {
+    if (spawn(&workers[i], docfd, file->size, arenafd))
+      alive++;
+  }
+
+  if (!alive) {
+    munmap(arena, ARENA_SIZE);
+    close(arenafd);
+    close(docfd);
+    free(workers);
+    free(fds);
+    free(state);
+    free(attempts);
+    return false;
+  }
+
+  file->arena = arena;
+  file->arena_size = ARENA_SIZE;
+
+  // The first page was rendered by loadfile()
+  state[0] = PS_DONE;
+  u32 remaining = file->pages - 1;
+  u32 next = 1;
+
+  while (remaining && !abort->load(std::memory_order_acquire)) {
+
+    // Give work to the idle ones
+    for (i = 0; i < count; i++) {
+      if (workers[i].pid <= 0 || workers[i].page >= 0)
+        continue;
+
+      const s32 page = pickpage(state, &next, count * 3);
+      if (page < 0)
+        break;
+
+      const u32 p = page;
+      if (swrite(workers[i].jobfd, &p, sizeof(u32)) == sizeof(u32)) {
+        workers[i].page = page;
+        state[page] = PS_INFLIGHT;
+      }
+    }
+
+    // No worker left, do the rest here
+    if (!alive) {
+      for (i = 1; i < file->pages; i++) {
+        if (state[i] != PS_DONE) {
+          fallback(i);
+          state[i] = PS_DONE;
+          remaining--;
+        }
+      }
+      break;
+    }
+
+    u32 nfds = 0;
+    for (i = 0; i < count; i++) {
+      if (workers[i].pid > 0) {
+        fds[nfds].fd      = workers[i].resfd;
+        fds[nfds].events  = POLLIN;
+        fds[nfds].revents = 0;
+        nfds++;
+      }
+    }
+
+    if (poll(fds, nfds, 100) <= 0)
+      continue;
+
+    for (i = 0; i < count; i++) {
+      procworker * const w = &workers[i];
+      if (w->pid <= 0) continue;
+
+      u32 f;
+      for (f = 0; f < nfds && fds[f].fd != w->resfd; f++);
+      if (f == nfds || !fds[f].revents) continue;
+
+      procresult res;
+      const ssize_t got = sread(w->resfd, &res, sizeof(procresult));
+      if (got == sizeof(procresult) && (s32) res.page == w->page) {
+
+        cachedpage * const cur = &file->cache[res.page];
+
+        if (res.status == RES_OK) {
+          cur->size         = res.size;
+          cur->uncompressed = res.uncompressed;
+          cur->w            = res.w;
+          cur->h            = res.h;
+          cur->left         = res.left;
+          cur->right        = res.right;
+          cur->top          = res.top;
+          cur->bottom       = res.bottom;
+          cur->data         = arena + res.offset;
+          pageready(res.page);
+        }
+        else {
+          fallback(res.page);
+        }
+
+        state[res.page] = PS_DONE;
+        remaining--;
+        w->page = -1;
+        continue;
+      }
+
+      // The worker died: retry its page, then replace it. Once its pipe
+      // is closed, the zygote may have reaped it and its pid be reused.
+      const s32 page = w->page;
+      reap(w, got > 0);
+      alive--;
+
+      if (page >= 0) {
+        if (++attempts[page] < MAX_ATTEMPTS) {
+          state[page] = PS_TODO;
+          if ((u32) page < next) next = page;
+        }
+        else {
+          if (details)
+            err(_("Page %d crashed the renderer, left blank\n"), page + 1);
+          blankpage(page);
+          pageready(page);
+          state[page] = PS_DONE;
+          remaining--;
+        }
+      }
+
+      if (spawn(w, docfd, file->size, arenafd))
+        alive++;
+    }
+  }
+
+  const bool aborted = abort->load(std::memory_order_acquire);
+  for (i = 0; i < count; i++)
+    reap(&workers[i], aborted);
+
+  close(arenafd);
+  close(docfd);
+  free(workers);
+  free(fds);
+  free(state);
+  free(attempts);
+
+  return true;
+}
@@ -0,0 +1,39 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROCRENDER_H
+#define PROCRENDER_H
+
+#include <atomic>
+
+#include "lrtypes.h"
+
+// Start the zygote the worker processes are forked from. Must be called
+// before any thread is created, see procrender() otherwise.
+void procrender_init();
+
+// Render the pages of the current file in a pool of forked worker
+// processes. The compressed pages are written in a shared memory arena
+// that this process maps read-only (file->arena). A worker that crashes
+// only costs a retry of the page it was working on.
+//
+// fallback is used to render in-process the pages the workers could
+// not store. Returns false if the pool could not be started at all,
+// as without procrender_init().
+bool procrender(const u32 count, const std::atomic<bool> * const abort,
+                void (*fallback)(const u32 page));
+
+#endif
@@ -0,0 +1,262 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Record the events given to the view, and play them back as fast as
+// the view can draw them. The file is text, one line per entry:
+//
+//   v <ms> <mode> <columns> <title pages> <zoom> <xoff> <yoff> <w> <h>
+//   e <ms> <event> <x> <y> <dx> <dy> <keysym> <state> <clicks>
+//
+// A v line is written before the first event and each time the view
+// settings change outside of the recorded events, from the toolbar.
+
+#include "replay.h"
+#include "latency.h"
+#include "trace.h"
+
+#define REPLAY_MAGIC "# updf events 1"
+
+bool recording = false;
+
+static FILE * out = NULL;
+static u64    epoch = 0;
+
+struct viewstate {
+  u32   mode, columns, titles;
+  float zoom, xoff, yoff;
+  s32   w, h;
+};
+
+static viewstate last;
+static bool      written = false;
+
+struct replayentry {
+  bool      isview;
+  viewstate view;
+  s32       event, x, y, dx, dy, keysym, state, clicks;
+};
+
+static replayentry * entries = NULL;
+static u32           entrycount = 0;
+static Fl_Window   * replaywin = NULL;
+static PDFView     * replayview = NULL;
+
+void record_start(const char *filename) {
+
+  out = fopen(filename, "w");
+  if (!out)
+    die(_("Can't create %s\n"), filename);
+
+  fprintf(out, "%s\n", REPLAY_MAGIC);
+
+  epoch = latency_now();
+  recording = true;
+}
+
+static viewstate snapshot(const PDFView * const view) {
+
+  viewstate s;
+
+  s.mode    = view->mode();
+  s.columns = view->get_columns();
+  s.titles  = view->get_title_page_count();
+  s.zoom    = view->zoom();
+  s.xoff    = view->get_xoff();
+  s.yoff    = view->get_yoff();
+  s.w       = view->w();
+  s.h       = view->h();
+
+  return s;
+}
+
+void record_event(const int e, const PDFView * const view) {
+
+  switch (e) {
+    case FL_PUSH:
+    case FL_DRAG:
+    case FL_RELEASE:
+    case FL_MOUSEWHEEL:
+    case FL_KEYDOWN:
+    case FL_SHORTCUT:
+    break;
+    default:
+      return;
+  }
+
+  const float ms = (latency_now() - epoch) / 1000.0f;
+  const viewstate s = snapshot(view);
+
+  if (!written || s.mode != last.mode || s.columns != last.columns ||
+      s.titles != last.titles || s.zoom != last.zoom ||
+      s.w != last.w || s.h != last.h) {
+    fprintf(out, "v %.1f %u %u %u %.6f %.6f %.6f %d %d\n", ms, s.mode,
+      s.columns, s.titles, s.zoom, s.xoff, s.yoff, s.w, s.h);
+    written = true;
+  }
+  last = s;
+
+  fprintf(out, "e %.1f %d %d %d %d %d %d %d %d\n", ms, e,
+    Fl::event_x(), Fl::event_y(), Fl::event_dx(), Fl::event_dy(),
+    Fl::event_key(), Fl::event_state(), Fl::event_clicks());
+}
+
+void record_stop() {
+
+  if (!out)
+    return;
+
+  recording = false;
+  if (fclose(out))
+    err(_("Failed writing the recorded events\n"));
+  out = NULL;
+}
+
+static void load(const char *filename) {
+
+  FILE * const f = fopen(filename, "r");
+  if (!f)
+    die(_("Can't open %s\n"), filename);
+
+  char line[256];
+  if (!fgets(line, 256, f) || strncmp(line, REPLAY_MAGIC, strlen(REPLAY_MAGIC)))
+    die(_("%s is not a recording\n"), filename);
+
+  u32 size = 0, n = 0;
+  while (fgets(line, 256, f)) {
+    if (n == size) {
+      size = size * 2 + 256;
+      entries = (replayentry *) xrealloc(entries, size * sizeof(replayentry));
+    }
+
+    replayentry * const r = &entries[n];
+    float ms;
+    bool ok;
+
+    if (line[0] == 'v') {
+      viewstate * const s = &r->view;
+      r->isview = true;
+      ok = sscanf(line, "v %f %u %u %u %f %f %f %d %d", &ms, &s->mode,
+        &s->columns, &s->titles, &s->zoom, &s->xoff, &s->yoff,
+        &s->w, &s->h) == 9;
+    }
+    else {
+      r->isview = false;
+      ok = sscanf(line, "e %f %d %d %d %d %d %d %d %d", &ms, &r->event,
+        &r->x, &r->y, &r->dx, &r->dy, &r->keysym, &r->state, &r->clicks) == 9;
+    }
+
+    if (!ok)
+      die(_("Bad line in %s: %s"), filename, line);
+    n++;
+  }
+
+  fclose(f);
+  entrycount = n;
+}
+
+static void apply(const viewstate * const s) {
+
+  PDFView * const v = replayview;
+
+  // Same view size as when recorded, for the same pages on screen
+  if (v->w() != s->w || v->h() != s->h)
+    replaywin->size(replaywin->w() + s->w - v->w(), replaywin->h() + s->h - v->h());
+
+  v->mode((view_mode_enum) s->mode);
+  v->set_columns(s->columns);
+  v->set_title_page_count(s->titles);
+  v->zoom(s->zoom);
+  v->set_offsets(s->xoff, s->yoff);
+}
+
+static void inject(const replayentry * const r) {
+
+  Fl::e_number    = r->event;
+  Fl::e_x         = r->x;
+  Fl::e_y         = r->y;
+  Fl::e_x_root    = r->x + replaywin->x();
+  Fl::e_y_root    = r->y + replaywin->y();
+  Fl::e_dx        = r->dx;
+  Fl::e_dy        = r->dy;
+  Fl::e_keysym    = r->keysym;
+  Fl::e_state     = r->state;
+  Fl::e_clicks    = r->clicks;
+  Fl::e_is_click  = 0;
+
+  replayview->handle(r->event);
+}
+
+// Play everything back to back. Each event is drawn and the X server
+// waited for, so that a frame is counted whole.
+static void play() {
+
+  u32 i, events = 0;
+
+  latency_reset();
+  replayview->reset_cache_stats();
+
+  const u64 start = latency_now();
+
+  for (i = 0; i < entrycount; i++) {
+    if (entries[i].isview) {
+      apply(&entries[i].view);
+    }
+    else {
+      inject(&entries[i]);
+      events++;
+    }
+
+    Fl::flush();
+    XSync(fl_display, False);
+  }
+
+  const u64 us = latency_now() - start;
+  const u32 hits = replayview->get_cache_hits();
+  const u32 misses = replayview->get_cache_misses();
+
+  printf(_("Replayed %u events in %.1f ms, %.3f ms per event\n"), events,
+    us / 1000.0f, events ? us / 1000.0f / events : 0.0f);
+  printf(_("Pixmap cache: %u hits, %u misses, %.1f%% hit rate\n"), hits, misses,
+    hits + misses ? 100.0f * hits / (hits + misses) : 0.0f);
+  latency_print(stdout);
+
+  latency_save();
+  if (tracing)
+    trace_dump();
+
+  exit(0);
+}
+
+// Wait for the whole document, so that all runs draw the same pages
+static void cb_wait(void *)
+{
+  if (!file->cache || !file->complete.load()) {
+    Fl::repeat_timeout(0.1, cb_wait);
+    return;
+  }
+
+  play();
+}
+
+void replay_start(const char *filename, Fl_Window * const win, PDFView * const view) {
+
+  load(filename);
+
+  replaywin = win;
+  replayview = view;
+
+  Fl::add_timeout(0.1, cb_wait);
+}
@@ -0,0 +1,296 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "scan.h"
+#include "search.h"
+#include "textcache.h"
+#include <ctype.h>
+#include <float.h>
+#include <regex.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Scan tasks are tagged apart from the documents, so that they can be
+// cancelled alone.
+#define SCAN_TAG 0x80000000u
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static std::atomic<u32> generation(0);
+static bool      active = false;
+static char    * pattern = NULL;
+static u32       patlen = 0;
+static bool      isregex = false;
+
+static u32       pages = 0;
+static s32     * found = NULL;   // Matches per page, -1 if not scanned
+
+// Owned by the UI thread
+static u32       scanned = 0;    // Pages before the first one not scanned
+static u32     * hits = NULL;
+static u32       hitcount = 0;
+
+static std::atomic<bool> posted(false);
+
+static void post() {
+
+  bool expected = false;
+  if (posted.compare_exchange_strong(expected, true)) {
+    core_message(MSG_SEARCH);
+  }
+}
+
+static void lower(char * s, u32 len) {
+
+  for (; len; len--, s++) {
+    if ((u8) *s < 128)
+      *s = tolower(*s);
+  }
+}
+
+// Occurrences of needle, found by looking at the first and last bytes of
+// 16 candidate positions at once, then comparing the middle of those
+// that pass.
+static u32 literal(const char * const hay, const u32 len,
+                   const char * const needle, const u32 n) {
+
+  u32 count = 0, i = 0;
+
+  if (n > len)
+    return 0;
+
+#ifdef __SSE2__
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[n - 1]);
+
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    const __m128i bf = _mm_loadu_si128((const __m128i *) (hay + i));
+    const __m128i bl = _mm_loadu_si128((const __m128i *) (hay + i + n - 1));
+    u32 mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, bf),
+                                               _mm_cmpeq_epi8(last, bl)));
+    while (mask) {
+      const u32 bit = __builtin_ctz(mask);
+      if (n <= 2 || !memcmp(hay + i + bit + 1, needle + 1, n - 2))
+        count++;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i + n <= len; i++) {
+    if (hay[i] == needle[0] && hay[i + n - 1] == needle[n - 1] &&
+        !memcmp(hay + i, needle, n))
+      count++;
+  }
+
+  return count;
+}
+
+static u32 expression(const regex_t * const re, const char * text) {
+
+  regmatch_t m;
+  u32 count = 0;
+  int flags = 0;
+
+  while (!regexec(re, text, 1, &m, flags)) {
+    count++;
+    if (m.rm_eo == 0) {
+      // Empty match, move on
+      if (!*text) break;
+      text++;
+    }
+    else {
+      text += m.rm_eo;
+    }
+    flags = REG_NOTBOL;
+  }
+
+  return count;
+}
+
+// The text of a page as already extracted, by the render threads, the
+// index or the text cache, as wordgrid does. Interpreting the page again
+// is the last resort.
+static const textlayer *layer(const u32 page, textlayer ** const own) {
+
+  *own = NULL;
+  if (page_ready(page) && file->cache[page].text)
+    return file->cache[page].text;
+
+  const textlayer *found = search_layer(page, own);
+  if (found)
+    return found;
+
+  if ((*own = text_cache_layer(page)))
+    return *own;
+
+  return textlayer_page(page, own);
+}
+
+static void scantask(void *arg) {
+
+  const u32 first = (uintptr_t) arg;
+
+  // Take a copy of the query, it may change under us
+  pthread_mutex_lock(&lock);
+  const u32 gen = generation;
+  const bool re = isregex;
+  const u32 n = patlen;
+  char * const needle = (char *) xmalloc(n + 1);
+  memcpy(needle, pattern, n + 1);
+  pthread_mutex_unlock(&lock);
+
+  // Each task has its own automaton, glibc serializes the users of one
+  regex_t compiled;
+  if (re && regcomp(&compiled, needle, REG_EXTENDED | REG_ICASE | REG_NEWLINE)) {
+    free(needle);
+    return;
+  }
+
+  u32 page;
+  for (page = first; page < first + SCAN_CHUNK && page < pages; page++) {
+    if (generation != gen)
+      break;
+
+    textlayer *own;
+    const textlayer * const src = layer(page, &own);
+    char * const text = textlayer_get(src, -FLT_MAX, -FLT_MAX, FLT_MAX, FLT_MAX);
+    free(own);
+
+    u32 count;
+    if (re) {
+      count = expression(&compiled, text);
+    }
+    else {
+      const u32 len = strlen(text);
+      lower(text, len);
+      count = literal(text, len, needle, n);
+    }
+    free(text);
+
+    pthread_mutex_lock(&lock);
+    if (generation == gen)
+      found[page] = count;
+    pthread_mutex_unlock(&lock);
+
+    post();
+  }
+
+  if (re)
+    regfree(&compiled);
+  free(needle);
+}
+
+void scan_stop() {
+
+  if (!active)
+    return;
+
+  pthread_mutex_lock(&lock);
+  const u32 gen = generation++;
+  active = false;
+  pthread_mutex_unlock(&lock);
+
+  pool->cancel(SCAN_TAG | gen);
+
+  pthread_mutex_lock(&lock);
+  free(found);
+  free(pattern);
+  found = NULL;
+  pattern = NULL;
+  pthread_mutex_unlock(&lock);
+
+  free(hits);
+  hits = NULL;
+  hitcount = scanned = 0;
+}
+
+bool scan_start(const char * const str, const bool regex) {
+
+  scan_stop();
+
+  if (!*str || !file->cache)
+    return true;
+
+  if (regex) {
+    regex_t test;
+    if (regcomp(&test, str, REG_EXTENDED | REG_ICASE | REG_NEWLINE))
+      return false;
+    regfree(&test);
+  }
+
+  pthread_mutex_lock(&lock);
+
+  pages = file->pages;
+  found = (s32 *) xmalloc(pages * sizeof(s32));
+  memset(found, 0xff, pages * sizeof(s32));
+
+  patlen = strlen(str);
+  pattern = strdup(str);
+  if (!pattern)
+    die(_("Out of memory\n"));
+  if (!regex)
+    lower(pattern, patlen);
+  isregex = regex;
+  active = true;
+
+  const u32 tag = SCAN_TAG | generation;
+
+  pthread_mutex_unlock(&lock);
+
+  hits = (u32 *) xcalloc(pages, sizeof(u32));
+
+  // Urgent tasks are taken first-in last-out, queue the end first
+  u32 chunk = (pages + SCAN_CHUNK - 1) / SCAN_CHUNK;
+  while (chunk--)
+    pool->submit(scantask, (void *) (uintptr_t) (chunk * SCAN_CHUNK), tag, true);
+
+  return true;
+}
+
+u32 scan_hits(bool * const complete) {
+
+  posted = false;
+
+  if (!active) {
+    *complete = true;
+    return 0;
+  }
+
+  pthread_mutex_lock(&lock);
+  for (; scanned < pages && found[scanned] >= 0; scanned++) {
+    if (found[scanned])
+      hits[hitcount++] = scanned;
+  }
+  pthread_mutex_unlock(&lock);
+
+  *complete = scanned == pages;
+  return hitcount;
+}
+
+bool scan_next(const u32 page, u32 * const hit) {
+
+  if (!hitcount)
+    return false;
+
+  u32 i;
+  for (i = 0; i < hitcount && hits[i] <= page; i++);
+  *hit = hits[i < hitcount ? i : 0];
+
+  return true;
+}
@@ -0,0 +1,42 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "lrtypes.h"
+
+// Pages scanned by one pool task
+#define SCAN_CHUNK 8
+
+// Look for a phrase, or an extended regular expression, in the text of
+// every page, ignoring case. The pages are split across the render
+// threads; MSG_SEARCH is sent as they complete. A running scan is
+// cancelled. False if the expression does not compile.
+bool scan_start(const char * const pattern, const bool regex);
+
+// Cancel the scan, if any
+void scan_stop();
+
+// Number of pages with matches so far, counting only the pages up to the
+// first one not scanned yet, so that hits come in page order. Rearms
+// MSG_SEARCH.
+u32 scan_hits(bool * const complete);
+
+// First hit after page, wrapping around. False if there is none.
+bool scan_next(const u32 page, u32 * const hit);
+
+#endif
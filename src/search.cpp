@@ -0,0 +1,664 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "search.h"
+#include "textstore.h"
+#include <ctype.h>
+
+// The index maps every word of the document to the places it appears.
+// Words are stored lowercased, without surrounding punctuation, in one
+// growing buffer; a hash table of term numbers finds them.
+//
+// When the saved store was made from this very file, the index is not
+// built: the queries are answered from the mapped store, unless its
+// content turns out to differ.
+
+struct term {
+  u32       str;
+  u32       len;
+  u32       hash;
+  u32       count, cap;
+  posting * list;
+};
+
+// A page being indexed, its words normalized
+struct pageterms {
+  u32    count;
+  u32  * str;
+  u32  * len;
+  char * text;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static u32        doc = 0;
+static u32        pages = 0;
+
+static term     * terms = NULL;
+static u32        termcount = 0, termcap = 0;
+static u32      * slots = NULL;   // Term number + 1, 0 is empty
+static u32        slotcount = 0;
+static char     * strs = NULL;
+static u32        strsize = 0, strcap = 0;
+
+static u8       * indexed = NULL;
+static u32        indexedcount = 0;
+
+// Kept to save the store once every page is indexed
+static const textlayer ** layers = NULL;
+static u8       * owned = NULL;
+static u64      * prints = NULL;
+
+static const storeheader * stored = NULL;
+
+// The current query
+static char       query[256];
+static u32        qterms = 0;
+static u32        qstr[QUERY_TERMS], qlen[QUERY_TERMS];
+
+static u32      * hits = NULL;
+static u32        hitcount = 0;
+static std::atomic<bool> posted(false);
+
+// Bumped whenever the boxes of a page may have changed
+static std::atomic<u32> generation(1);
+
+static u32 fnv(const char * const s, const u32 len) {
+
+  u32 h = 2166136261u, i;
+  for (i = 0; i < len; i++) {
+    h ^= (u8) s[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Lowercase, strip the punctuation around the word. Non-ASCII bytes are
+// kept as they are.
+static u32 normalize(const char * src, u32 len, char * const dst) {
+
+  while (len && (u8) *src < 128 && !isalnum(*src)) {
+    src++;
+    len--;
+  }
+  while (len && (u8) src[len - 1] < 128 && !isalnum(src[len - 1]))
+    len--;
+
+  u32 i;
+  for (i = 0; i < len; i++)
+    dst[i] = (u8) src[i] < 128 ? tolower(src[i]) : src[i];
+
+  return len;
+}
+
+static void changed() {
+
+  generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void post() {
+
+  bool expected = false;
+  if (posted.compare_exchange_strong(expected, true)) {
+    core_message(MSG_SEARCH);
+  }
+}
+
+static void rehash() {
+
+  slotcount = slotcount ? slotcount * 2 : 4096;
+  free(slots);
+  slots = (u32 *) xcalloc(slotcount, sizeof(u32));
+
+  u32 i;
+  for (i = 0; i < termcount; i++) {
+    u32 s = terms[i].hash & (slotcount - 1);
+    while (slots[s])
+      s = (s + 1) & (slotcount - 1);
+    slots[s] = i + 1;
+  }
+}
+
+static term *lookup(const char * const s, const u32 len, const bool create) {
+
+  if (!slotcount) {
+    if (!create) return NULL;
+    rehash();
+  }
+
+  const u32 h = fnv(s, len);
+  u32 slot = h & (slotcount - 1);
+
+  while (slots[slot]) {
+    term * const t = &terms[slots[slot] - 1];
+    if (t->hash == h && t->len == len && !memcmp(strs + t->str, s, len))
+      return t;
+    slot = (slot + 1) & (slotcount - 1);
+  }
+
+  if (!create)
+    return NULL;
+
+  if (termcount == termcap) {
+    termcap = termcap ? termcap * 2 : 1024;
+    terms = (term *) xrealloc(terms, termcap * sizeof(term));
+  }
+  while (strsize + len > strcap) {
+    strcap = strcap ? strcap * 2 : 65536;
+    strs = (char *) xrealloc(strs, strcap);
+  }
+
+  term * const t = &terms[termcount];
+  memset(t, 0, sizeof(term));
+  t->str = strsize;
+  t->len = len;
+  t->hash = h;
+  memcpy(strs + strsize, s, len);
+  strsize += len;
+
+  slots[slot] = ++termcount;
+  if (termcount * 2 > slotcount)
+    rehash();
+
+  return t;
+}
+
+static void add(term * const t, const u32 page, const u32 word) {
+
+  if (t->count == t->cap) {
+    t->cap = t->cap ? t->cap * 2 : 4;
+    t->list = (posting *) xrealloc(t->list, t->cap * sizeof(posting));
+  }
+  t->list[t->count].page = page;
+  t->list[t->count].word = word;
+  t->count++;
+}
+
+static bool termmatch(const char * const s, const u32 len, const u32 q) {
+
+  const bool prefix = q == qterms - 1;
+  if (len < qlen[q] || (!prefix && len != qlen[q]))
+    return false;
+  return !memcmp(s, query + qstr[q], qlen[q]);
+}
+
+static bool pagematch(const pageterms * const pt) {
+
+  u32 q, i;
+  for (q = 0; q < qterms; q++) {
+    for (i = 0; i < pt->count; i++) {
+      if (termmatch(pt->text + pt->str[i], pt->len[i], q))
+        break;
+    }
+    if (i == pt->count)
+      return false;
+  }
+  return qterms > 0;
+}
+
+static void addhit(const u32 page) {
+
+  // Pages mostly come in order
+  u32 i = hitcount;
+  while (i && hits[i - 1] > page) {
+    hits[i] = hits[i - 1];
+    i--;
+  }
+  hits[i] = page;
+  hitcount++;
+}
+
+static void mark(const posting * const list, const u32 count, const u32 q,
+                 u32 * const found, u32 * const last) {
+
+  u32 i;
+  for (i = 0; i < count; i++) {
+    const u32 page = list[i].page;
+    if (last[page] != q + 1) {
+      last[page] = q + 1;
+      found[page]++;
+    }
+  }
+}
+
+static int termcmp(const char * const a, const u32 alen,
+                   const char * const b, const u32 blen) {
+
+  const int ret = memcmp(a, b, alen < blen ? alen : blen);
+  if (ret)
+    return ret;
+  return (int) alen - (int) blen;
+}
+
+// The stored terms are sorted, those starting with the query term follow
+// the first one not below it
+static void markstored(const u32 q, u32 * const found, u32 * const last) {
+
+  const storeterm * const st = (const storeterm *) ((const u8 *) stored + stored->terms);
+  const char * const sstrs = (const char *) stored + stored->strs;
+  const posting * const spost = (const posting *) ((const u8 *) stored + stored->postings);
+
+  u32 lo = 0, hi = stored->termcount;
+  while (lo < hi) {
+    const u32 mid = (lo + hi) / 2;
+    if (termcmp(sstrs + st[mid].str, st[mid].len, query + qstr[q], qlen[q]) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (; lo < stored->termcount; lo++) {
+    const storeterm * const t = &st[lo];
+    if (t->len < qlen[q] || memcmp(sstrs + t->str, query + qstr[q], qlen[q]))
+      break;
+    if (termmatch(sstrs + t->str, t->len, q))
+      mark(spost + t->post, t->count, q, found, last);
+  }
+}
+
+// Run the query over the pages indexed so far
+static void evaluate() {
+
+  hitcount = 0;
+  if (!qterms || !pages)
+    return;
+
+  u32 * const found = (u32 *) xcalloc(pages, sizeof(u32));
+  u32 * const last = (u32 *) xcalloc(pages, sizeof(u32));
+  u32 q, i;
+
+  for (q = 0; q < qterms; q++) {
+    if (stored) {
+      markstored(q, found, last);
+      continue;
+    }
+    for (i = 0; i < termcount; i++) {
+      const term * const t = &terms[i];
+      if (termmatch(strs + t->str, t->len, q))
+        mark(t->list, t->count, q, found, last);
+    }
+  }
+
+  for (i = 0; i < pages; i++) {
+    if (found[i] == qterms)
+      hits[hitcount++] = i;
+  }
+
+  free(found);
+  free(last);
+}
+
+static void pagewords(const textlayer * const layer, pageterms * const pt) {
+
+  u32 i, bytes = 0;
+  for (i = 0; i < layer->count; i++)
+    bytes += layer->words[i].len;
+
+  pt->count = 0;
+  pt->str = (u32 *) xcalloc(layer->count + 1, sizeof(u32));
+  pt->len = (u32 *) xcalloc(layer->count + 1, sizeof(u32));
+  pt->text = (char *) xmalloc(bytes + 1);
+
+  u32 pos = 0;
+  for (i = 0; i < layer->count; i++) {
+    const textword * const w = &layer->words[i];
+    const u32 len = normalize(layer->text + w->text, w->len, pt->text + pos);
+    if (!len)
+      continue;
+    pt->str[pt->count] = pos;
+    pt->len[pt->count] = len;
+    pt->count++;
+    pos += len;
+  }
+}
+
+static int sortterms(const void * a, const void * b) {
+
+  const term * const ta = &terms[*(const u32 *) a];
+  const term * const tb = &terms[*(const u32 *) b];
+
+  return termcmp(strs + ta->str, ta->len, strs + tb->str, tb->len);
+}
+
+// Every page is indexed, save it all for the next time
+static void save() {
+
+  pthread_mutex_lock(&lock);
+
+  u32 * const order = (u32 *) xmalloc((termcount + 1) * sizeof(u32));
+  u32 i, postcount = 0;
+  for (i = 0; i < termcount; i++) {
+    order[i] = i;
+    postcount += terms[i].count;
+  }
+  qsort(order, termcount, sizeof(u32), sortterms);
+
+  storeterm * const st = (storeterm *) xcalloc(termcount + 1, sizeof(storeterm));
+  posting * const post = (posting *) xmalloc((postcount + 1) * sizeof(posting));
+  u32 pos = 0;
+  for (i = 0; i < termcount; i++) {
+    const term * const t = &terms[order[i]];
+    st[i].str = t->str;
+    st[i].len = t->len;
+    st[i].post = pos;
+    st[i].count = t->count;
+    memcpy(post + pos, t->list, t->count * sizeof(posting));
+    pos += t->count;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  // Nothing changes the terms anymore
+  store_write(layers, prints, st, termcount, strs, strsize, post, postcount);
+
+  free(order);
+  free(st);
+  free(post);
+}
+
+static void indextask(void *arg) {
+
+  const u32 page = (uintptr_t) arg;
+  const u32 mydoc = file->doc;
+
+  // Unchanged pages are taken from the store
+  const u64 print = page_fingerprint(page);
+  textlayer *own = store_layer(page, print);
+  const textlayer *layer = own;
+  if (!layer)
+    layer = textlayer_page(page, &own);
+
+  pageterms pt;
+  pagewords(layer, &pt);
+
+  bool complete = false;
+
+  pthread_mutex_lock(&lock);
+
+  if (doc == mydoc && !indexed[page]) {
+    u32 i;
+    for (i = 0; i < pt.count; i++)
+      add(lookup(pt.text + pt.str[i], pt.len[i], true), page, i);
+
+    indexed[page] = 1;
+    indexedcount++;
+    changed();
+    layers[page] = layer;
+    owned[page] = own != NULL;
+    prints[page] = print;
+    complete = indexedcount == pages;
+
+    if (pagematch(&pt)) {
+      addhit(page);
+      post();
+    }
+    else if (complete) {
+      post();
+    }
+  }
+  else {
+    free(own);
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  free(pt.str);
+  free(pt.len);
+  free(pt.text);
+
+  if (complete)
+    save();
+}
+
+// The store was taken on the file size, mtime and inode. Its content is
+// checked behind the pages, and indexed again if it differs.
+static void verifytask(void *) {
+
+  if (store_verify())
+    return;
+
+  if (details)
+    printf(_("Text store outdated, indexing again\n"));
+
+  pthread_mutex_lock(&lock);
+  stored = NULL;
+  memset(indexed, 0, pages);
+  indexedcount = 0;
+  evaluate();
+  changed();
+  pthread_mutex_unlock(&lock);
+
+  post();
+
+  u32 i;
+  for (i = 0; i < pages; i++)
+    pool->submit(indextask, (void *) (uintptr_t) i, doc);
+}
+
+static void opentask(void *) {
+
+  bool exact;
+  const storeheader * const hdr = store_open(&exact);
+
+  if (exact) {
+    pthread_mutex_lock(&lock);
+    stored = hdr;
+    memset(indexed, 1, pages);
+    indexedcount = pages;
+    evaluate();
+    changed();
+    pthread_mutex_unlock(&lock);
+
+    post();
+
+    pool->submit(verifytask, NULL, doc);
+    return;
+  }
+
+  u32 i;
+  for (i = 0; i < pages; i++)
+    pool->submit(indextask, (void *) (uintptr_t) i, doc);
+}
+
+void index_start() {
+
+  pthread_mutex_lock(&lock);
+
+  doc = file->doc;
+  pages = file->pages;
+  indexed = (u8 *) xcalloc(pages, 1);
+  hits = (u32 *) xcalloc(pages, sizeof(u32));
+  hitcount = 0;
+  layers = (const textlayer **) xcalloc(pages, sizeof(textlayer *));
+  owned = (u8 *) xcalloc(pages, 1);
+  prints = (u64 *) xcalloc(pages, sizeof(u64));
+  changed();
+
+  pthread_mutex_unlock(&lock);
+
+  // Ahead of the pages, a saved index makes search available at once
+  pool->submit(opentask, NULL, doc, true);
+
+  post();
+}
+
+void index_clear() {
+
+  pthread_mutex_lock(&lock);
+
+  u32 i;
+  for (i = 0; i < termcount; i++)
+    free(terms[i].list);
+  free(terms);
+  free(slots);
+  free(strs);
+  free(indexed);
+  free(hits);
+
+  for (i = 0; i < pages; i++) {
+    if (owned[i])
+      free((void *) layers[i]);
+  }
+  free(layers);
+  free(owned);
+  free(prints);
+
+  store_close();
+  stored = NULL;
+
+  terms = NULL;
+  slots = NULL;
+  strs = NULL;
+  indexed = NULL;
+  hits = NULL;
+  layers = NULL;
+  owned = NULL;
+  prints = NULL;
+  termcount = termcap = slotcount = strsize = strcap = 0;
+  indexedcount = hitcount = 0;
+  doc = pages = 0;
+  changed();
+
+  pthread_mutex_unlock(&lock);
+}
+
+void search_set(const char * const str) {
+
+  pthread_mutex_lock(&lock);
+
+  // Split into normalized words
+  qterms = 0;
+  u32 pos = 0;
+  const char *cur = str;
+  while (*cur && qterms < QUERY_TERMS) {
+    while (*cur == ' ' || *cur == '\t')
+      cur++;
+    const char *end = cur;
+    while (*end && *end != ' ' && *end != '\t')
+      end++;
+
+    u32 len = end - cur;
+    if (pos + len > sizeof(query))
+      break;
+    len = normalize(cur, len, query + pos);
+    if (len) {
+      qstr[qterms] = pos;
+      qlen[qterms] = len;
+      qterms++;
+      pos += len;
+    }
+    cur = end;
+  }
+
+  evaluate();
+  changed();
+
+  pthread_mutex_unlock(&lock);
+}
+
+u32 search_hits(bool * const complete) {
+
+  posted = false;
+
+  pthread_mutex_lock(&lock);
+  const u32 count = hitcount;
+  *complete = indexedcount == pages;
+  pthread_mutex_unlock(&lock);
+
+  return count;
+}
+
+u32 search_generation() {
+
+  return generation.load(std::memory_order_relaxed);
+}
+
+u32 search_boxes(const u32 page, float ** const boxes) {
+
+  u32 count = 0, cap = 0;
+  *boxes = NULL;
+
+  pthread_mutex_lock(&lock);
+
+  if (qterms && page < pages && indexed[page]) {
+    textlayer * const own = stored ? store_exact_layer(page) : NULL;
+    const textlayer * const layer = own ? own : layers[page];
+    char word[256];
+    u32 i, q;
+
+    for (i = 0; layer && i < layer->count; i++) {
+      const textword * const w = &layer->words[i];
+      if (w->len > sizeof(word))
+        continue;
+
+      const u32 len = normalize(layer->text + w->text, w->len, word);
+      for (q = 0; q < qterms; q++) {
+        if (termmatch(word, len, q))
+          break;
+      }
+      if (q == qterms)
+        continue;
+
+      if (count == cap) {
+        cap = cap ? cap * 2 : 64;
+        *boxes = (float *) xrealloc(*boxes, cap * 4 * sizeof(float));
+      }
+
+      float * const b = *boxes + count * 4;
+      b[0] = w->x0;
+      b[1] = w->y0;
+      b[2] = w->x1;
+      b[3] = w->y1;
+      count++;
+    }
+
+    free(own);
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return count;
+}
+
+const textlayer *search_layer(const u32 page, textlayer ** const own) {
+
+  const textlayer *layer = NULL;
+  *own = NULL;
+
+  pthread_mutex_lock(&lock);
+  if (page < pages && indexed[page])
+    layer = stored ? (*own = store_exact_layer(page)) : layers[page];
+  pthread_mutex_unlock(&lock);
+
+  return layer;
+}
+
+bool search_next(const u32 page, u32 * const hit) {
+
+  bool found = false;
+
+  pthread_mutex_lock(&lock);
+  if (hitcount) {
+    u32 i;
+    for (i = 0; i < hitcount && hits[i] <= page; i++);
+    *hit = hits[i < hitcount ? i : 0];
+    found = true;
+  }
+  pthread_mutex_unlock(&lock);
+
+  return found;
+}
@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "lrtypes.h"
+
+struct textlayer;
+
+#define QUERY_TERMS 16
+
+// Index the words of every page of the current file in the background,
+// after the pages are rendered.
+void index_start();
+
+// Drop the index, the tasks of the file must be cancelled
+void index_clear();
+
+// Look for the pages holding all the words of the query, the last one
+// being possibly incomplete. Pages indexed later are checked as they
+// come, and MSG_SEARCH is sent when the hits change.
+void search_set(const char * const query);
+
+// Number of pages found so far, and whether all pages were looked at.
+// Rearms MSG_SEARCH.
+u32 search_hits(bool * const complete);
+
+// Boxes of the words of a page matching the query, as x0, y0, x1, y1
+// in 144 dpi page coordinates, in *boxes for the caller to free. Only
+// indexed pages have some. They stay the same as long as
+// search_generation() does.
+u32 search_boxes(const u32 page, float ** const boxes);
+u32 search_generation();
+
+// The text layer the index was built from, NULL if the page is not
+// indexed. *own is set when the caller has to free it.
+const textlayer *search_layer(const u32 page, textlayer ** const own);
+
+// First hit after page, wrapping around. False if there is none.
+bool search_next(const u32 page, u32 * const hit);
+
+#endif
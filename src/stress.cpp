@@ -0,0 +1,240 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// updf-stress: race the entry points of the core against its threads.
+// Does what the UI thread would, open, scroll, reload, search, close,
+// in a random order and without waiting for the pool or the loader.
+// Each open picks how the file is read: whole for live reload, mapped,
+// or first page first by the loader thread when it's linearized.
+// Built with -fsanitize=thread for make check, see stress.sh.
+
+#include "core.h"
+#include "notify.h"
+#include "scan.h"
+#include "search.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <locale.h>
+
+enum action {
+  A_OPEN = 0,
+  A_SCROLL,
+  A_PAGE,
+  A_RELOAD,
+  A_SEARCH,
+  A_SCAN,
+  A_CLOSE,
+  A_THREADS,
+  A_WAIT,
+  A_COUNT
+};
+
+static u32 state;
+static int readpipe;
+
+// xorshift, the same seed gives the same order of calls
+static u32 pick(const u32 max) {
+
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+
+  return state % max;
+}
+
+// Replace dst by a copy of src in one step, as an editor saving would
+static void copyfile(const char *src, const char *dst) {
+
+  char tmp[PATH_MAX];
+  snprintf(tmp, PATH_MAX, "%s.tmp", dst);
+
+  const int in = open(src, O_RDONLY);
+  const int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (in < 0 || out < 0)
+    die(_("Can't copy %s to %s\n"), src, tmp);
+
+  u8 buf[65536];
+  ssize_t got;
+  while ((got = read(in, buf, 65536)) > 0) {
+    if (swrite(out, buf, got) != got)
+      die(_("Can't copy %s to %s\n"), src, tmp);
+  }
+
+  close(in);
+  close(out);
+
+  if (rename(tmp, dst))
+    die(_("Can't copy %s to %s\n"), src, dst);
+}
+
+// What reader() and notified() do in the app
+static void drain() {
+
+  u8 msg;
+  bool complete;
+
+  while (read(readpipe, &msg, 1) == 1) {
+    switch (msg) {
+      case MSG_RELOADED:
+        core_reload_swap();
+      break;
+      case MSG_SEARCH:
+        search_hits(&complete);
+        scan_hits(&complete);
+      break;
+    }
+  }
+
+  notify_drain(file->first_visible, file->last_visible);
+}
+
+int main(int argc, char **argv) {
+
+  #if ENABLE_NLS
+    setlocale(LC_MESSAGES, "");
+    bindtextdomain("updf", LOCALEDIR);
+    textdomain("updf");
+  #endif
+
+  u32 rounds = 400, seed = 1;
+  const char *work = "stress-work.pdf";
+
+  const struct option opts[] = {
+    { "rounds", 1, NULL, 'n' },
+    { "seed",   1, NULL, 's' },
+    { "work",   1, NULL, 'w' },
+    { "help",   0, NULL, 'h' },
+    { NULL,     0, NULL,  0  }
+  };
+
+  while (1) {
+    const int c = getopt_long(argc, argv, "hn:s:w:", opts, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 'n':
+        rounds = strtoul(optarg, NULL, 10);
+      break;
+      case 's':
+        seed = strtoul(optarg, NULL, 10);
+      break;
+      case 'w':
+        work = optarg;
+      break;
+      case 'h':
+      default:
+        printf(_("Usage: %s [options] file.pdf...\n\n"
+          "   -h --help   This help\n"
+          "   -n --rounds N       Make N calls into the core (default: 400)\n"
+          "   -s --seed N         Seed of the order of the calls (default: 1)\n"
+          "   -w --work FILE      The copy opened and reloaded\n"
+          "                       (default: stress-work.pdf)\n"),
+          argv[0]);
+        return 0;
+      break;
+    }
+  }
+
+  if (optind >= argc)
+    die(_("No document given, see %s --help\n"), argv[0]);
+
+  state = seed * 2654435761u | 1;
+
+  // Threads only, forking worker processes under TSan is not supported
+  render_processes = 0;
+  render_threads = 4;
+  text_layer = true;
+  text_index = true;
+
+  core_init();
+
+  int ptmp[2];
+  if (pipe2(ptmp, O_NONBLOCK))
+    die(_("Failed in pipe()\n"));
+  readpipe = ptmp[0];
+  writepipe = ptmp[1];
+
+  notify_init();
+
+  const u32 docs = argc - optind;
+  u32 opened = 0, failed = 0, r;
+  bool watched = false;
+
+  for (r = 0; r < rounds; r++) {
+    const char * const doc = argv[optind + pick(docs)];
+    int pdferror = 0;
+
+    switch (pick(A_COUNT)) {
+      case A_OPEN:
+        copyfile(doc, work);
+        live_reload = pick(2);
+        assume_remote = pick(2);
+        if (core_open(work, &pdferror, 0, pick(4)) == CORE_OK)
+          opened++;
+        else
+          failed++;
+        watched = live_reload;
+      break;
+      case A_SCROLL:
+        if (file->pages) {
+          const u32 first = pick(file->pages);
+          const u32 last = first + pick(4);
+          file->first_visible = first;
+          file->last_visible = last < file->pages ? last : file->pages - 1;
+          render_visible(file->first_visible, file->last_visible);
+        }
+      break;
+      case A_PAGE:
+        if (file->pages)
+          core_page(pick(file->pages));
+      break;
+      case A_RELOAD:
+        // Often another document, so that pages differ. As in the app,
+        // only for a file opened to be followed.
+        if (file->pages && watched) {
+          copyfile(doc, work);
+          core_reload(&pdferror);
+        }
+      break;
+      case A_SEARCH:
+        search_set(pick(2) ? "the" : "");
+      break;
+      case A_SCAN:
+        scan_start(pick(2) ? "e" : "^[a-z]+ ", pick(2));
+      break;
+      case A_CLOSE:
+        core_close();
+      break;
+      case A_THREADS:
+        core_threads(1 + pick(4));
+      break;
+      case A_WAIT:
+        usleep(pick(20000));
+      break;
+    }
+
+    drain();
+  }
+
+  core_close();
+  unlink(work);
+
+  printf(_("%u rounds, %u opens, %u failed\n"), rounds, opened, failed);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Run by make check: updf-stress, built with -fsanitize=thread, on a few
+# synthetic documents. A data race or a lock inversion fails the test.
+# SEED and ROUNDS pick the run.
+
+CORPUS=stress-corpus
+SEED=${SEED:-1}
+ROUNDS=${ROUNDS:-400}
+
+TSAN_OPTIONS=${TSAN_OPTIONS:-"halt_on_error=1 second_deadlock_stack=1"}
+export TSAN_OPTIONS
+
+set -e
+
+./updf-corpus -o "$CORPUS" -s "$SEED" text vector mixed margins blank linear \
+	>/dev/null
+exec ./updf-stress -s "$SEED" -n "$ROUNDS" "$CORPUS"/*.pdf
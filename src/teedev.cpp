@@ -0,0 +1,281 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <SplashOutputDev.h>
+#include <TextOutputDev.h>
+
+#include "teedev.h"
+
+TeeOutputDev::TeeOutputDev(SplashOutputDev * s, TextOutputDev * t):
+  splash(s), text(t), type3(0) {
+}
+
+GBool TeeOutputDev::upsideDown() { return splash->upsideDown(); }
+GBool TeeOutputDev::useDrawChar() { return gTrue; }
+GBool TeeOutputDev::useTilingPatternFill() { return splash->useTilingPatternFill(); }
+GBool TeeOutputDev::useShadedFills(int type) { return splash->useShadedFills(type); }
+GBool TeeOutputDev::interpretType3Chars() { return splash->interpretType3Chars(); }
+GBool TeeOutputDev::needNonText() { return gTrue; }
+
+void TeeOutputDev::setDefaultCTM(double * ctm) {
+  OutputDev::setDefaultCTM(ctm);
+  splash->setDefaultCTM(ctm);
+  text->setDefaultCTM(ctm);
+}
+
+void TeeOutputDev::setVectorAntialias(GBool vaa) { splash->setVectorAntialias(vaa); }
+GBool TeeOutputDev::getVectorAntialias() { return splash->getVectorAntialias(); }
+
+void TeeOutputDev::startPage(int pageNum, GfxState * state, XRef * xref) {
+  type3 = 0;
+  splash->startPage(pageNum, state, xref);
+  text->startPage(pageNum, state, xref);
+}
+
+void TeeOutputDev::endPage() {
+  splash->endPage();
+  text->endPage();
+}
+
+void TeeOutputDev::saveState(GfxState * state) {
+  splash->saveState(state);
+  text->saveState(state);
+}
+
+void TeeOutputDev::restoreState(GfxState * state) {
+  splash->restoreState(state);
+  text->restoreState(state);
+}
+
+void TeeOutputDev::updateAll(GfxState * state) {
+  splash->updateAll(state);
+  text->updateAll(state);
+}
+
+void TeeOutputDev::updateCTM(GfxState * state, double m11, double m12,
+                             double m21, double m22, double m31, double m32) {
+  splash->updateCTM(state, m11, m12, m21, m22, m31, m32);
+}
+
+void TeeOutputDev::updateLineDash(GfxState * state) { splash->updateLineDash(state); }
+void TeeOutputDev::updateFlatness(GfxState * state) { splash->updateFlatness(state); }
+void TeeOutputDev::updateLineJoin(GfxState * state) { splash->updateLineJoin(state); }
+void TeeOutputDev::updateLineCap(GfxState * state) { splash->updateLineCap(state); }
+void TeeOutputDev::updateMiterLimit(GfxState * state) { splash->updateMiterLimit(state); }
+void TeeOutputDev::updateLineWidth(GfxState * state) { splash->updateLineWidth(state); }
+void TeeOutputDev::updateStrokeAdjust(GfxState * state) { splash->updateStrokeAdjust(state); }
+void TeeOutputDev::updateFillColor(GfxState * state) { splash->updateFillColor(state); }
+void TeeOutputDev::updateStrokeColor(GfxState * state) { splash->updateStrokeColor(state); }
+void TeeOutputDev::updateBlendMode(GfxState * state) { splash->updateBlendMode(state); }
+void TeeOutputDev::updateFillOpacity(GfxState * state) { splash->updateFillOpacity(state); }
+void TeeOutputDev::updateStrokeOpacity(GfxState * state) { splash->updateStrokeOpacity(state); }
+void TeeOutputDev::updateFillOverprint(GfxState * state) { splash->updateFillOverprint(state); }
+void TeeOutputDev::updateStrokeOverprint(GfxState * state) { splash->updateStrokeOverprint(state); }
+void TeeOutputDev::updateOverprintMode(GfxState * state) { splash->updateOverprintMode(state); }
+void TeeOutputDev::updateTransfer(GfxState * state) { splash->updateTransfer(state); }
+
+void TeeOutputDev::updateFont(GfxState * state) {
+  splash->updateFont(state);
+  text->updateFont(state);
+}
+
+// The text device looks at strokes and fills to find underlines. The paths
+// making up a Type 3 glyph are not underlines.
+
+void TeeOutputDev::stroke(GfxState * state) {
+  splash->stroke(state);
+  if (!type3) text->stroke(state);
+}
+
+void TeeOutputDev::fill(GfxState * state) {
+  splash->fill(state);
+  if (!type3) text->fill(state);
+}
+
+void TeeOutputDev::eoFill(GfxState * state) {
+  splash->eoFill(state);
+  if (!type3) text->eoFill(state);
+}
+
+GBool TeeOutputDev::tilingPatternFill(GfxState * state, Gfx * gfx, Catalog * cat,
+                                      Object * str, double * pmat, int paintType,
+                                      int tilingType, Dict * resDict, double * mat,
+                                      double * bbox, int x0, int y0, int x1, int y1,
+                                      double xStep, double yStep) {
+  return splash->tilingPatternFill(state, gfx, cat, str, pmat, paintType,
+                                   tilingType, resDict, mat, bbox,
+                                   x0, y0, x1, y1, xStep, yStep);
+}
+
+GBool TeeOutputDev::functionShadedFill(GfxState * state, GfxFunctionShading * shading) {
+  return splash->functionShadedFill(state, shading);
+}
+
+GBool TeeOutputDev::axialShadedFill(GfxState * state, GfxAxialShading * shading,
+                                    double tMin, double tMax) {
+  return splash->axialShadedFill(state, shading, tMin, tMax);
+}
+
+GBool TeeOutputDev::axialShadedSupportExtend(GfxState * state, GfxAxialShading * shading) {
+  return splash->axialShadedSupportExtend(state, shading);
+}
+
+GBool TeeOutputDev::radialShadedFill(GfxState * state, GfxRadialShading * shading,
+                                     double sMin, double sMax) {
+  return splash->radialShadedFill(state, shading, sMin, sMax);
+}
+
+GBool TeeOutputDev::radialShadedSupportExtend(GfxState * state, GfxRadialShading * shading) {
+  return splash->radialShadedSupportExtend(state, shading);
+}
+
+GBool TeeOutputDev::gouraudTriangleShadedFill(GfxState * state,
+                                              GfxGouraudTriangleShading * shading) {
+  return splash->gouraudTriangleShadedFill(state, shading);
+}
+
+void TeeOutputDev::clip(GfxState * state) { splash->clip(state); }
+void TeeOutputDev::eoClip(GfxState * state) { splash->eoClip(state); }
+void TeeOutputDev::clipToStrokePath(GfxState * state) { splash->clipToStrokePath(state); }
+
+void TeeOutputDev::beginString(GfxState * state, GooString * s) {
+  splash->beginString(state, s);
+  text->beginString(state, s);
+}
+
+void TeeOutputDev::endString(GfxState * state) {
+  splash->endString(state);
+  text->endString(state);
+}
+
+void TeeOutputDev::drawChar(GfxState * state, double x, double y,
+                            double dx, double dy,
+                            double originX, double originY,
+                            CharCode code, int nBytes,
+                            Unicode * u, int uLen) {
+  splash->drawChar(state, x, y, dx, dy, originX, originY, code, nBytes, u, uLen);
+  if (!type3) text->drawChar(state, x, y, dx, dy, originX, originY, code, nBytes, u, uLen);
+}
+
+// Gfx only calls drawChar() for Type 3 fonts when the device does not
+// interpret them. Splash does, so the text device is handed the character
+// here. When splash has the glyph cached, the procedure is not run and
+// endType3Char() is not called.
+
+GBool TeeOutputDev::beginType3Char(GfxState * state, double x, double y,
+                                   double dx, double dy, CharCode code,
+                                   Unicode * u, int uLen) {
+  if (!type3) text->drawChar(state, x, y, dx, dy, 0, 0, code, 1, u, uLen);
+  if (splash->beginType3Char(state, x, y, dx, dy, code, u, uLen)) return gTrue;
+  type3++;
+  return gFalse;
+}
+
+void TeeOutputDev::endType3Char(GfxState * state) {
+  splash->endType3Char(state);
+  if (type3) type3--;
+}
+
+void TeeOutputDev::beginTextObject(GfxState * state) { splash->beginTextObject(state); }
+void TeeOutputDev::endTextObject(GfxState * state) { splash->endTextObject(state); }
+void TeeOutputDev::incCharCount(int nChars) { text->incCharCount(nChars); }
+
+void TeeOutputDev::beginActualText(GfxState * state, GooString * s) {
+  text->beginActualText(state, s);
+}
+
+void TeeOutputDev::endActualText(GfxState * state) {
+  text->endActualText(state);
+}
+
+void TeeOutputDev::drawImageMask(GfxState * state, Object * ref, Stream * str,
+                                 int width, int height, GBool invert,
+                                 GBool interpolate, GBool inlineImg) {
+  splash->drawImageMask(state, ref, str, width, height, invert, interpolate, inlineImg);
+}
+
+void TeeOutputDev::setSoftMaskFromImageMask(GfxState * state, Object * ref,
+                                            Stream * str, int width, int height,
+                                            GBool invert, GBool inlineImg,
+                                            double * baseMatrix) {
+  splash->setSoftMaskFromImageMask(state, ref, str, width, height,
+                                   invert, inlineImg, baseMatrix);
+}
+
+void TeeOutputDev::unsetSoftMaskFromImageMask(GfxState * state, double * baseMatrix) {
+  splash->unsetSoftMaskFromImageMask(state, baseMatrix);
+}
+
+void TeeOutputDev::drawImage(GfxState * state, Object * ref, Stream * str,
+                             int width, int height, GfxImageColorMap * colorMap,
+                             GBool interpolate, int * maskColors, GBool inlineImg) {
+  splash->drawImage(state, ref, str, width, height, colorMap,
+                    interpolate, maskColors, inlineImg);
+}
+
+void TeeOutputDev::drawMaskedImage(GfxState * state, Object * ref, Stream * str,
+                                   int width, int height, GfxImageColorMap * colorMap,
+                                   GBool interpolate, Stream * maskStr,
+                                   int maskWidth, int maskHeight,
+                                   GBool maskInvert, GBool maskInterpolate) {
+  splash->drawMaskedImage(state, ref, str, width, height, colorMap, interpolate,
+                          maskStr, maskWidth, maskHeight, maskInvert, maskInterpolate);
+}
+
+void TeeOutputDev::drawSoftMaskedImage(GfxState * state, Object * ref, Stream * str,
+                                       int width, int height, GfxImageColorMap * colorMap,
+                                       GBool interpolate, Stream * maskStr,
+                                       int maskWidth, int maskHeight,
+                                       GfxImageColorMap * maskColorMap,
+                                       GBool maskInterpolate) {
+  splash->drawSoftMaskedImage(state, ref, str, width, height, colorMap, interpolate,
+                              maskStr, maskWidth, maskHeight, maskColorMap,
+                              maskInterpolate);
+}
+
+void TeeOutputDev::type3D0(GfxState * state, double wx, double wy) {
+  splash->type3D0(state, wx, wy);
+}
+
+void TeeOutputDev::type3D1(GfxState * state, double wx, double wy,
+                           double llx, double lly, double urx, double ury) {
+  splash->type3D1(state, wx, wy, llx, lly, urx, ury);
+}
+
+void TeeOutputDev::beginTransparencyGroup(GfxState * state, double * bbox,
+                                          GfxColorSpace * blendingColorSpace,
+                                          GBool isolated, GBool knockout,
+                                          GBool forSoftMask) {
+  splash->beginTransparencyGroup(state, bbox, blendingColorSpace,
+                                 isolated, knockout, forSoftMask);
+}
+
+void TeeOutputDev::endTransparencyGroup(GfxState * state) {
+  splash->endTransparencyGroup(state);
+}
+
+void TeeOutputDev::paintTransparencyGroup(GfxState * state, double * bbox) {
+  splash->paintTransparencyGroup(state, bbox);
+}
+
+void TeeOutputDev::setSoftMask(GfxState * state, double * bbox, GBool alpha,
+                               Function * transferFunc, GfxColor * backdropColor) {
+  splash->setSoftMask(state, bbox, alpha, transferFunc, backdropColor);
+}
+
+void TeeOutputDev::clearSoftMask(GfxState * state) {
+  splash->clearSoftMask(state);
+}
@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEEDEV_H
+#define TEEDEV_H
+
+#include <OutputDev.h>
+
+#include "lrtypes.h"
+
+class SplashOutputDev;
+class TextOutputDev;
+
+// Drives a SplashOutputDev and a TextOutputDev from a single displayPage(),
+// so that the page content stream is interpreted once for both.
+//
+// The splash device leads: its answers to the capability queries are used,
+// and the operations the text device ignores (clipping, images, shadings,
+// transparency) only go to it. Type 3 glyphs are drawn by splash, the text
+// device gets them as plain characters.
+//
+// Every method overrides one of OutputDev: when poppler changes a
+// signature, the build fails instead of the calls silently going to
+// the OutputDev default.
+class TeeOutputDev: public OutputDev {
+public:
+  TeeOutputDev(SplashOutputDev * splash, TextOutputDev * text);
+
+  GBool upsideDown() override;
+  GBool useDrawChar() override;
+  GBool useTilingPatternFill() override;
+  GBool useShadedFills(int type) override;
+  GBool interpretType3Chars() override;
+  GBool needNonText() override;
+
+  void setDefaultCTM(double * ctm) override;
+  void setVectorAntialias(GBool vaa) override;
+  GBool getVectorAntialias() override;
+
+  void startPage(int pageNum, GfxState * state, XRef * xref) override;
+  void endPage() override;
+
+  void saveState(GfxState * state) override;
+  void restoreState(GfxState * state) override;
+
+  void updateAll(GfxState * state) override;
+  void updateCTM(GfxState * state, double m11, double m12,
+                 double m21, double m22, double m31, double m32) override;
+  void updateLineDash(GfxState * state) override;
+  void updateFlatness(GfxState * state) override;
+  void updateLineJoin(GfxState * state) override;
+  void updateLineCap(GfxState * state) override;
+  void updateMiterLimit(GfxState * state) override;
+  void updateLineWidth(GfxState * state) override;
+  void updateStrokeAdjust(GfxState * state) override;
+  void updateFillColor(GfxState * state) override;
+  void updateStrokeColor(GfxState * state) override;
+  void updateBlendMode(GfxState * state) override;
+  void updateFillOpacity(GfxState * state) override;
+  void updateStrokeOpacity(GfxState * state) override;
+  void updateFillOverprint(GfxState * state) override;
+  void updateStrokeOverprint(GfxState * state) override;
+  void updateOverprintMode(GfxState * state) override;
+  void updateTransfer(GfxState * state) override;
+  void updateFont(GfxState * state) override;
+
+  void stroke(GfxState * state) override;
+  void fill(GfxState * state) override;
+  void eoFill(GfxState * state) override;
+  GBool tilingPatternFill(GfxState * state, Gfx * gfx, Catalog * cat,
+                          Object * str, double * pmat, int paintType,
+                          int tilingType, Dict * resDict, double * mat,
+                          double * bbox, int x0, int y0, int x1, int y1,
+                          double xStep, double yStep) override;
+  GBool functionShadedFill(GfxState * state, GfxFunctionShading * shading) override;
+  GBool axialShadedFill(GfxState * state, GfxAxialShading * shading,
+                        double tMin, double tMax) override;
+  GBool axialShadedSupportExtend(GfxState * state, GfxAxialShading * shading) override;
+  GBool radialShadedFill(GfxState * state, GfxRadialShading * shading,
+                         double sMin, double sMax) override;
+  GBool radialShadedSupportExtend(GfxState * state, GfxRadialShading * shading) override;
+  GBool gouraudTriangleShadedFill(GfxState * state,
+                                  GfxGouraudTriangleShading * shading) override;
+
+  void clip(GfxState * state) override;
+  void eoClip(GfxState * state) override;
+  void clipToStrokePath(GfxState * state) override;
+
+  void beginString(GfxState * state, GooString * s) override;
+  void endString(GfxState * state) override;
+  void drawChar(GfxState * state, double x, double y, double dx, double dy,
+                double originX, double originY, CharCode code, int nBytes,
+                Unicode * u, int uLen) override;
+  GBool beginType3Char(GfxState * state, double x, double y,
+                       double dx, double dy, CharCode code,
+                       Unicode * u, int uLen) override;
+  void endType3Char(GfxState * state) override;
+  void beginTextObject(GfxState * state) override;
+  void endTextObject(GfxState * state) override;
+  void incCharCount(int nChars) override;
+  void beginActualText(GfxState * state, GooString * text) override;
+  void endActualText(GfxState * state) override;
+
+  void drawImageMask(GfxState * state, Object * ref, Stream * str,
+                     int width, int height, GBool invert,
+                     GBool interpolate, GBool inlineImg) override;
+  void setSoftMaskFromImageMask(GfxState * state, Object * ref, Stream * str,
+                                int width, int height, GBool invert,
+                                GBool inlineImg, double * baseMatrix) override;
+  void unsetSoftMaskFromImageMask(GfxState * state, double * baseMatrix) override;
+  void drawImage(GfxState * state, Object * ref, Stream * str,
+                 int width, int height, GfxImageColorMap * colorMap,
+                 GBool interpolate, int * maskColors, GBool inlineImg) override;
+  void drawMaskedImage(GfxState * state, Object * ref, Stream * str,
+                       int width, int height, GfxImageColorMap * colorMap,
+                       GBool interpolate, Stream * maskStr,
+                       int maskWidth, int maskHeight,
+                       GBool maskInvert, GBool maskInterpolate) override;
+  void drawSoftMaskedImage(GfxState * state, Object * ref, Stream * str,
+                           int width, int height, GfxImageColorMap * colorMap,
+                           GBool interpolate, Stream * maskStr,
+                           int maskWidth, int maskHeight,
+                           GfxImageColorMap * maskColorMap,
+                           GBool maskInterpolate) override;
+
+  void type3D0(GfxState * state, double wx, double wy) override;
+  void type3D1(GfxState * state, double wx, double wy,
+               double llx, double lly, double urx, double ury) override;
+
+  void beginTransparencyGroup(GfxState * state, double * bbox,
+                              GfxColorSpace * blendingColorSpace,
+                              GBool isolated, GBool knockout,
+                              GBool forSoftMask) override;
+  void endTransparencyGroup(GfxState * state) override;
+  void paintTransparencyGroup(GfxState * state, double * bbox) override;
+  void setSoftMask(GfxState * state, double * bbox, GBool alpha,
+                   Function * transferFunc, GfxColor * backdropColor) override;
+  void clearSoftMask(GfxState * state) override;
+
+private:
+  SplashOutputDev * splash;
+  TextOutputDev   * text;
+  u32               type3;   // Depth of Type 3 glyph procedures being run
+};
+
+#endif
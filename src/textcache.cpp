@@ -0,0 +1,210 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "textcache.h"
+#include <TextOutputDev.h>
+
+// An entry with a page but no text is being extracted
+struct textentry {
+  u32        doc;
+  u32        page;
+  TextPage * text;
+  u64        used;
+};
+
+static textentry       entries[TEXT_CACHE_MAX];
+static u64             stamp = 0;
+
+// Also protects the TextPage reference counts
+static pthread_mutex_t lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  built = PTHREAD_COND_INITIALIZER;
+
+static TextPage *extract(const u32 page) {
+
+  TextOutputDev dev(NULL, true, 0, false, false);
+  workerdoc()->displayPage(&dev, page + 1, RENDER_DPI, RENDER_DPI, 0, true, false, false);
+
+  return dev.takeText();
+}
+
+static textentry *find(const u32 doc, const u32 page) {
+
+  u32 i;
+  for (i = 0; i < TEXT_CACHE_MAX; i++) {
+    if (entries[i].doc == doc && entries[i].page == page)
+      return &entries[i];
+  }
+  return NULL;
+}
+
+// Least recently used entry, never one being extracted
+static textentry *reserve(const u32 doc, const u32 page) {
+
+  textentry *victim = NULL;
+  u32 i;
+
+  for (i = 0; i < TEXT_CACHE_MAX; i++) {
+    textentry * const e = &entries[i];
+    if (e->doc && !e->text)
+      continue;
+    if (!victim || e->used < victim->used)
+      victim = e;
+  }
+
+  if (victim) {
+    if (victim->text)
+      victim->text->decRefCnt();
+    victim->doc  = doc;
+    victim->page = page;
+    victim->text = NULL;
+    victim->used = ++stamp;
+  }
+
+  return victim;
+}
+
+// Store the text of a reserved entry, unless it was dropped meanwhile
+static void fill(const u32 doc, const u32 page, TextPage * const text) {
+
+  textentry * const e = find(doc, page);
+
+  if (e && !e->text)
+    e->text = text;
+  else
+    text->decRefCnt();
+
+  pthread_cond_broadcast(&built);
+}
+
+static void prefetchtask(void *arg) {
+
+  const u32 page = (uintptr_t) arg;
+  const u32 doc = file->doc;
+
+  pthread_mutex_lock(&lock);
+  const bool wanted = find(doc, page) != NULL;
+  pthread_mutex_unlock(&lock);
+
+  if (!wanted) return;
+
+  TextPage * const text = extract(page);
+
+  pthread_mutex_lock(&lock);
+  fill(doc, page, text);
+  pthread_mutex_unlock(&lock);
+}
+
+GooString *text_get(const u32 page, double x0, double y0, double x1, double y1) {
+
+  const u32 doc = file->doc;
+  TextPage *text;
+
+  pthread_mutex_lock(&lock);
+
+  while (true) {
+    textentry * const e = find(doc, page);
+
+    if (e && e->text) {
+      e->used = ++stamp;
+      text = e->text;
+      text->incRefCnt();
+      break;
+    }
+
+    if (e) {
+      // A render thread is on it
+      pthread_cond_wait(&built, &lock);
+      continue;
+    }
+
+    const bool cached = reserve(doc, page) != NULL;
+    pthread_mutex_unlock(&lock);
+
+    text = extract(page);
+
+    pthread_mutex_lock(&lock);
+    if (cached) {
+      text->incRefCnt();
+      fill(doc, page, text);
+    }
+    break;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  GooString * const str = text->getText(x0, y0, x1, y1);
+
+  pthread_mutex_lock(&lock);
+  text->decRefCnt();
+  pthread_mutex_unlock(&lock);
+
+  return str;
+}
+
+textlayer *text_cache_layer(const u32 page) {
+
+  pthread_mutex_lock(&lock);
+  textentry * const e = find(file->doc, page);
+  TextPage * const text = e ? e->text : NULL;
+  if (text) {
+    e->used = ++stamp;
+    text->incRefCnt();
+  }
+  pthread_mutex_unlock(&lock);
+
+  if (!text)
+    return NULL;
+
+  textlayer * const layer = textlayer_build(text);
+
+  pthread_mutex_lock(&lock);
+  text->decRefCnt();
+  pthread_mutex_unlock(&lock);
+
+  return layer;
+}
+
+void text_prefetch(const u32 first, const u32 last) {
+
+  const u32 doc = file->doc;
+  u32 page;
+
+  pthread_mutex_lock(&lock);
+  for (page = first; page <= last && page < file->pages &&
+                    page < first + TEXT_CACHE_MAX / 2; page++) {
+    // Already extracted along with the bitmap
+    if (page_ready(page) && file->cache[page].text)
+      continue;
+    if (!find(doc, page) && reserve(doc, page))
+      pool->submit(prefetchtask, (void *) (uintptr_t) page, doc, true);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void text_cache_clear() {
+
+  u32 i;
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < TEXT_CACHE_MAX; i++) {
+    if (entries[i].text)
+      entries[i].text->decRefCnt();
+    memset(&entries[i], 0, sizeof(textentry));
+  }
+  pthread_cond_broadcast(&built);
+  pthread_mutex_unlock(&lock);
+}
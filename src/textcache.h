@@ -0,0 +1,43 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+#include "lrtypes.h"
+
+class GooString;
+struct textlayer;
+
+// Pages whose extracted text is kept in memory
+#define TEXT_CACHE_MAX 8
+
+// Text of the current file inside a rectangle of a page, in 144 dpi
+// page coordinates. The page text is extracted once and kept in a
+// bounded cache, the caller owns the returned string.
+GooString *text_get(const u32 page, double x0, double y0, double x1, double y1);
+
+// The words of a page from its cached text, NULL if it is not cached.
+// No extraction is made. The caller frees it.
+textlayer *text_cache_layer(const u32 page);
+
+// Extract the text of these pages in the background
+void text_prefetch(const u32 first, const u32 last);
+
+// Forget everything, the render tasks of the file must be cancelled
+void text_cache_clear();
+
+#endif
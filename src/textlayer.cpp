@@ -0,0 +1,134 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "textlayer.h"
+#include "textstore.h"
+#include <TextOutputDev.h>
+
+// A word starts a new line when it goes back to the left, or when it
+// shares less than half its height with the previous one.
+static bool newline(const textword * const prev, const textword * const cur) {
+
+  if (cur->x0 < prev->x0)
+    return true;
+
+  const float top = cur->y0 > prev->y0 ? cur->y0 : prev->y0;
+  const float bottom = cur->y1 < prev->y1 ? cur->y1 : prev->y1;
+
+  return (bottom - top) * 2 < cur->y1 - cur->y0;
+}
+
+textlayer *textlayer_build(TextPage * const page) {
+
+  TextWordList * const list = page->makeWordList(false);
+  const u32 count = list->getLength();
+  u32 i, bytes = 0;
+
+  GooString ** const strs = (GooString **) xcalloc(count ? count : 1, sizeof(GooString *));
+  for (i = 0; i < count; i++) {
+    strs[i] = list->get(i)->getText();
+    bytes += strs[i]->getLength() + 1;
+  }
+
+  textlayer * const layer = (textlayer *) xcalloc(sizeof(textlayer) +
+                                                  count * sizeof(textword) +
+                                                  bytes, 1);
+  layer->count = count;
+  layer->words = (textword *) (layer + 1);
+  layer->text = (char *) (layer->words + count);
+
+  u32 pos = 0;
+  for (i = 0; i < count; i++) {
+    textword * const w = &layer->words[i];
+    double x0, y0, x1, y1;
+
+    list->get(i)->getBBox(&x0, &y0, &x1, &y1);
+    w->x0 = x0;
+    w->y0 = y0;
+    w->x1 = x1;
+    w->y1 = y1;
+
+    w->text = pos;
+    w->len = strs[i]->getLength();
+    memcpy(layer->text + pos, strs[i]->getCString(), w->len);
+    pos += w->len + 1;
+
+    if (i && newline(w - 1, w))
+      layer->lines++;
+    w->line = layer->lines;
+
+    delete strs[i];
+  }
+  if (count)
+    layer->lines++;
+
+  free(strs);
+  delete list;
+
+  return layer;
+}
+
+const textlayer *textlayer_page(const u32 page, textlayer ** const own) {
+
+  *own = NULL;
+  if (page_ready(page) && file->cache[page].text)
+    return file->cache[page].text;
+
+  if ((*own = store_exact_layer(page)))
+    return *own;
+
+  TextOutputDev dev(NULL, true, 0, false, false);
+  workerdoc()->displayPage(&dev, page + 1, RENDER_DPI, RENDER_DPI, 0, true, false, false);
+
+  TextPage * const text = dev.takeText();
+  *own = textlayer_build(text);
+  text->decRefCnt();
+
+  return *own;
+}
+
+char *textlayer_get(const textlayer * const layer,
+                    const float x0, const float y0,
+                    const float x1, const float y1) {
+
+  u32 i, bytes = 1;
+  for (i = 0; i < layer->count; i++)
+    bytes += layer->words[i].len + 1;
+
+  char * const out = (char *) xmalloc(bytes);
+  char *cur = out;
+  s32 line = -1;
+
+  for (i = 0; i < layer->count; i++) {
+    const textword * const w = &layer->words[i];
+    const float cx = (w->x0 + w->x1) / 2;
+    const float cy = (w->y0 + w->y1) / 2;
+
+    if (cx < x0 || cx > x1 || cy < y0 || cy > y1)
+      continue;
+
+    if (line >= 0)
+      *cur++ = line == w->line ? ' ' : '\n';
+    line = w->line;
+
+    memcpy(cur, layer->text + w->text, w->len);
+    cur += w->len;
+  }
+  *cur = '\0';
+
+  return out;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTLAYER_H
+#define TEXTLAYER_H
+
+#include "lrtypes.h"
+
+class TextPage;
+
+// A word of a page, in 144 dpi page coordinates
+struct textword {
+  float x0, y0, x1, y1;
+  u32   text;   // Offset of the UTF-8 text in textlayer.text
+  u16   len;
+  u16   line;   // Lines are numbered in reading order
+};
+
+// The words of a page in reading order, with their text packed in a
+// single buffer. One allocation, freed with free().
+struct textlayer {
+  u32        count;
+  u32        lines;
+  textword * words;
+  char     * text;
+};
+
+textlayer *textlayer_build(TextPage * const page);
+
+// The text layer of a page of the current file. When the page has none,
+// it is extracted now and *own is set, for the caller to free.
+const textlayer *textlayer_page(const u32 page, textlayer ** const own);
+
+// Text of the words whose center is inside the rectangle, lines separated
+// by newlines. The caller frees it.
+char *textlayer_get(const textlayer * const layer,
+                    const float x0, const float y0,
+                    const float x1, const float y1);
+
+#endif
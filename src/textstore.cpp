@@ -0,0 +1,527 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "textstore.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pwd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static u8  * map = NULL;
+static u64   mapsize = 0;
+static bool  exactmap = false;
+static u64   dochash = 0;     // 0 until needed
+
+// The stored pages by fingerprint, so that pages moved by an edit are
+// found again. Only for a store not made from this very file.
+struct storeprint {
+  u64 fingerprint;
+  u32 page;
+};
+
+static storeprint * prints = NULL;
+static u32          printcount = 0;
+
+#define ALIGN8(x) (((x) + 7) & ~(u64) 7)
+
+// Eight bytes at a time, good enough to tell documents apart
+static u64 hash64(const u8 * p, u64 len, u64 h) {
+
+  const u64 mul = 0x9e3779b97f4a7c15ull;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    u64 v;
+    memcpy(&v, p, 8);
+    h = (h ^ v) * mul;
+    h ^= h >> 29;
+  }
+  for (; len; len--, p++) {
+    h = (h ^ *p) * mul;
+    h ^= h >> 29;
+  }
+
+  return h;
+}
+
+static bool storepath(char * const path, const u32 size) {
+
+  const char *base = getenv("XDG_CACHE_HOME");
+  char dir[PATH_MAX];
+
+  if (base && *base) {
+    snprintf(dir, sizeof(dir), "%s/updf", base);
+  }
+  else {
+    const char *home = getenv("HOME");
+    if (!home) {
+      // Nowhere to keep it, the text is extracted each time
+      const struct passwd * const pw = getpwuid(getuid());
+      if (!pw || !pw->pw_dir)
+        return false;
+      home = pw->pw_dir;
+    }
+    snprintf(dir, sizeof(dir), "%s/.cache", home);
+    mkdir(dir, 0700);
+    snprintf(dir, sizeof(dir), "%s/.cache/updf", home);
+  }
+  mkdir(dir, 0700);
+
+  // Named after the document path, so that a modified document finds
+  // the text of its unchanged pages
+  char real[PATH_MAX];
+  if (!realpath(file->filename, real))
+    return false;
+
+  const u64 name = hash64((const u8 *) real, strlen(real), 0);
+  snprintf(path, size, "%s/%016llx.idx", dir, (unsigned long long) name);
+
+  return true;
+}
+
+// len bytes at off fit in size, aligned for what is read there
+static bool inside(const u64 off, const u64 len, const u64 size) {
+
+  return !(off & 7) && off <= size && len <= size - off;
+}
+
+// Everything search and the text layers read from the file must be in
+// it: a truncated or corrupted store is dropped, not read past its end.
+// The page count may differ, after an edit that added or removed pages.
+static bool valid(const storeheader * const hdr, const u64 size) {
+
+  if (size < sizeof(storeheader) ||
+      memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic)) ||
+      hdr->version != STORE_VERSION ||
+      hdr->size != size)
+    return false;
+
+  // In the order store_write() lays them out
+  if (!inside(hdr->pagetab, (u64) hdr->pages * sizeof(storepage), size) ||
+      !inside(hdr->terms, (u64) hdr->termcount * sizeof(storeterm), size) ||
+      !inside(hdr->strs, 0, size) || !inside(hdr->postings, 0, size) ||
+      hdr->postings < hdr->strs)
+    return false;
+
+  const u8 * const base = (const u8 *) hdr;
+  const storepage * const tab = (const storepage *) (base + hdr->pagetab);
+  u32 i, j;
+
+  for (i = 0; i < hdr->pages; i++) {
+    const storepage * const sp = &tab[i];
+    if (!inside(sp->words, (u64) sp->count * sizeof(textword), size) ||
+        !inside(sp->text, 0, size))
+      return false;
+
+    const textword * const words = (const textword *) (base + sp->words);
+    for (j = 0; j < sp->count; j++) {
+      if ((u64) words[j].text + words[j].len > size - sp->text)
+        return false;
+    }
+  }
+
+  const storeterm * const terms = (const storeterm *) (base + hdr->terms);
+  const u64 strsize = hdr->postings - hdr->strs;
+  const u64 postcount = (size - hdr->postings) / sizeof(posting);
+  const posting * const postings = (const posting *) (base + hdr->postings);
+
+  for (i = 0; i < hdr->termcount; i++) {
+    const storeterm * const t = &terms[i];
+    if ((u64) t->str + t->len > strsize ||
+        (u64) t->post + t->count > postcount)
+      return false;
+  }
+
+  // The hits index per page arrays
+  u64 p;
+  for (p = 0; p < postcount; p++) {
+    if (postings[p].page >= hdr->pages ||
+        postings[p].word >= tab[postings[p].page].count)
+      return false;
+  }
+
+  return true;
+}
+
+// Tells the file apart without reading it
+static u64 filestamp() {
+
+  const u64 v[3] = { file->size, file->mtime, file->inode };
+  return hash64((const u8 *) v, sizeof(v), 0);
+}
+
+static u64 contenthash() {
+
+  if (!dochash) {
+    wait_loaded();
+    dochash = hash64(file->data, file->size, file->size);
+  }
+  return dochash;
+}
+
+static const storepage *storedpage(const u32 page) {
+
+  const storeheader * const hdr = (const storeheader *) map;
+  return (const storepage *) (map + hdr->pagetab) + page;
+}
+
+static int printcmp(const void *a, const void *b) {
+
+  const u64 fa = ((const storeprint *) a)->fingerprint;
+  const u64 fb = ((const storeprint *) b)->fingerprint;
+
+  return fa < fb ? -1 : fa > fb;
+}
+
+static void buildprints() {
+
+  const storeheader * const hdr = (const storeheader *) map;
+
+  prints = (storeprint *) xmalloc(hdr->pages * sizeof(storeprint) + 1);
+  printcount = hdr->pages;
+
+  u32 i;
+  for (i = 0; i < printcount; i++) {
+    prints[i].fingerprint = storedpage(i)->fingerprint;
+    prints[i].page = i;
+  }
+
+  qsort(prints, printcount, sizeof(storeprint), printcmp);
+}
+
+const storeheader *store_open(bool * const exact) {
+
+  *exact = false;
+
+  char path[PATH_MAX];
+  if (!storepath(path, sizeof(path)))
+    return NULL;
+
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) || !st.st_size) {
+    close(fd);
+    return NULL;
+  }
+
+  u8 * const data = (u8 *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  const storeheader * const hdr = (const storeheader *) data;
+  if (!valid(hdr, st.st_size)) {
+    munmap(data, st.st_size);
+    return NULL;
+  }
+
+  map = data;
+  mapsize = st.st_size;
+  exactmap = *exact = hdr->stamp == filestamp() && hdr->pages == file->pages;
+
+  if (!exactmap)
+    buildprints();
+
+  if (details)
+    printf(_("Text store %s: %s, %u terms\n"), path,
+           exactmap ? _("exact") : _("partial"), hdr->termcount);
+
+  return hdr;
+}
+
+// The file may have been rewritten within the mtime granularity, or
+// have its mtime restored
+bool store_verify() {
+
+  if (!map)
+    return false;
+
+  if (((const storeheader *) map)->dochash == contenthash())
+    return true;
+
+  // Indexed again from here, the pages that draw the same are reused
+  if (!prints)
+    buildprints();
+  return false;
+}
+
+void store_close() {
+
+  if (map)
+    munmap(map, mapsize);
+
+  free(prints);
+
+  map = NULL;
+  mapsize = 0;
+  exactmap = false;
+  dochash = 0;
+  prints = NULL;
+  printcount = 0;
+}
+
+static u64 streamhash(Stream * const str, u64 h) {
+
+  Guchar buf[4096];
+  int n;
+
+  str->reset();
+  while ((n = str->getChars(sizeof(buf), buf)) > 0)
+    h = hash64(buf, n, h);
+  str->close();
+
+  return h;
+}
+
+// The images and forms drawn by the page, as stored in the file. Fonts
+// are left out: a LaTeX run changes the subsets used by every page.
+static u64 xobjecthash(Page * const p, u64 h) {
+
+  Dict * const res = p->getResourceDict();
+  if (!res)
+    return h;
+
+#if POPPLER_OBJECT_RVALUE
+  Object xobjs = res->lookup("XObject");
+  if (xobjs.isDict()) {
+    Dict * const d = xobjs.getDict();
+    int i;
+    for (i = 0; i < d->getLength(); i++) {
+      Object x = d->getVal(i);
+      if (x.isStream())
+        h = streamhash(x.getStream()->getUndecodedStream(), h);
+    }
+  }
+#else
+  Object xobjs;
+  res->lookup("XObject", &xobjs);
+  if (xobjs.isDict()) {
+    Dict * const d = xobjs.getDict();
+    int i;
+    for (i = 0; i < d->getLength(); i++) {
+      Object x;
+      d->getVal(i, &x);
+      if (x.isStream())
+        h = streamhash(x.getStream()->getUndecodedStream(), h);
+      x.free();
+    }
+  }
+  xobjs.free();
+#endif
+
+  return h;
+}
+
+u64 pdf_fingerprint(PDFDoc * const pdf, const u32 page) {
+
+  Page * const p = pdf->getPage(page + 1);
+  const double dims[3] = { p->getMediaWidth(), p->getMediaHeight(),
+                           (double) p->getRotate() };
+  u64 h = hash64((const u8 *) dims, sizeof(dims), 0);
+
+#if POPPLER_OBJECT_RVALUE
+  Object contents = p->getContents();
+  if (contents.isStream()) {
+    h = streamhash(contents.getStream(), h);
+  }
+  else if (contents.isArray()) {
+    int i;
+    for (i = 0; i < contents.arrayGetLength(); i++) {
+      Object part = contents.arrayGet(i);
+      if (part.isStream())
+        h = streamhash(part.getStream(), h);
+    }
+  }
+#else
+  Object contents;
+  p->getContents(&contents);
+  if (contents.isStream()) {
+    h = streamhash(contents.getStream(), h);
+  }
+  else if (contents.isArray()) {
+    int i;
+    for (i = 0; i < contents.arrayGetLength(); i++) {
+      Object part;
+      contents.arrayGet(i, &part);
+      if (part.isStream())
+        h = streamhash(part.getStream(), h);
+      part.free();
+    }
+  }
+  contents.free();
+#endif
+
+  h = xobjecthash(p, h);
+
+  // 0 is a page not fingerprinted yet
+  return h ? h : 1;
+}
+
+u64 page_fingerprint(const u32 page) {
+
+  return pdf_fingerprint(workerdoc(), page);
+}
+
+static textlayer *maplayer(const storepage * const sp) {
+
+  textlayer * const layer = (textlayer *) xcalloc(1, sizeof(textlayer));
+  layer->count = sp->count;
+  layer->lines = sp->lines;
+  layer->words = (textword *) (map + sp->words);
+  layer->text = (char *) (map + sp->text);
+
+  return layer;
+}
+
+textlayer *store_layer(const u32 page, const u64 fingerprint) {
+
+  if (!map)
+    return NULL;
+
+  // Most pages stay in place
+  const storeheader * const hdr = (const storeheader *) map;
+  if (page < hdr->pages && storedpage(page)->fingerprint == fingerprint)
+    return maplayer(storedpage(page));
+
+  if (!prints)
+    return NULL;
+
+  const storeprint key = { fingerprint, 0 };
+  const storeprint * const found = (const storeprint *)
+    bsearch(&key, prints, printcount, sizeof(storeprint), printcmp);
+
+  return found ? maplayer(storedpage(found->page)) : NULL;
+}
+
+textlayer *store_exact_layer(const u32 page) {
+
+  if (!exactmap)
+    return NULL;
+
+  return maplayer(storedpage(page));
+}
+
+// Size of the text of a layer, up to the end of its last word
+static u32 textsize(const textlayer * const layer) {
+
+  u32 i, size = 0;
+  for (i = 0; i < layer->count; i++) {
+    const u32 end = layer->words[i].text + layer->words[i].len + 1;
+    if (end > size)
+      size = end;
+  }
+  return size;
+}
+
+static void pad(FILE * const f, u64 * const pos) {
+
+  static const u8 zeros[8] = { 0 };
+  const u64 next = ALIGN8(*pos);
+
+  fwrite(zeros, 1, next - *pos, f);
+  *pos = next;
+}
+
+void store_write(const textlayer * const * const layers,
+                 const u64 * const fingerprints,
+                 const storeterm * const terms, const u32 termcount,
+                 const char * const strs, const u32 strsize,
+                 const posting * const postings, const u32 postcount) {
+
+  char path[PATH_MAX], tmp[PATH_MAX + 8];
+  if (!storepath(path, sizeof(path)))
+    return;
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+  const u32 pages = file->pages;
+  storeheader hdr;
+  memset(&hdr, 0, sizeof(storeheader));
+  memcpy(hdr.magic, STORE_MAGIC, sizeof(hdr.magic));
+  hdr.version = STORE_VERSION;
+  hdr.pages = pages;
+  hdr.stamp = filestamp();
+  hdr.dochash = contenthash();
+  hdr.termcount = termcount;
+
+  // Lay it out
+  storepage * const tab = (storepage *) xcalloc(pages, sizeof(storepage));
+  u64 pos = ALIGN8(sizeof(storeheader));
+  hdr.pagetab = pos;
+  pos = ALIGN8(pos + pages * sizeof(storepage));
+
+  u32 i;
+  for (i = 0; i < pages; i++) {
+    tab[i].fingerprint = fingerprints[i];
+    tab[i].count = layers[i]->count;
+    tab[i].lines = layers[i]->lines;
+    tab[i].words = pos;
+    pos = ALIGN8(pos + layers[i]->count * sizeof(textword));
+    tab[i].text = pos;
+    pos = ALIGN8(pos + textsize(layers[i]));
+  }
+
+  hdr.terms = pos;
+  pos = ALIGN8(pos + (u64) termcount * sizeof(storeterm));
+  hdr.strs = pos;
+  pos = ALIGN8(pos + strsize);
+  hdr.postings = pos;
+  pos += (u64) postcount * sizeof(posting);
+  hdr.size = pos;
+
+  FILE * const f = fopen(tmp, "w");
+  if (!f) {
+    free(tab);
+    return;
+  }
+
+  pos = sizeof(storeheader);
+  fwrite(&hdr, sizeof(storeheader), 1, f);
+  pad(f, &pos);
+  fwrite(tab, sizeof(storepage), pages, f);
+  pos += pages * sizeof(storepage);
+  pad(f, &pos);
+
+  for (i = 0; i < pages; i++) {
+    const u32 size = textsize(layers[i]);
+    fwrite(layers[i]->words, sizeof(textword), layers[i]->count, f);
+    pos += layers[i]->count * sizeof(textword);
+    pad(f, &pos);
+    fwrite(layers[i]->text, 1, size, f);
+    pos += size;
+    pad(f, &pos);
+  }
+
+  fwrite(terms, sizeof(storeterm), termcount, f);
+  pos += (u64) termcount * sizeof(storeterm);
+  pad(f, &pos);
+  fwrite(strs, 1, strsize, f);
+  pos += strsize;
+  pad(f, &pos);
+  fwrite(postings, sizeof(posting), postcount, f);
+
+  free(tab);
+
+  // The old store may still be mapped, it keeps its inode
+  const bool failed = ferror(f);
+  if (fclose(f) || failed || rename(tmp, path))
+    unlink(tmp);
+  else if (details)
+    printf(_("Text store %s saved, %u terms\n"), path, termcount);
+}
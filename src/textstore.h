@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTSTORE_H
+#define TEXTSTORE_H
+
+#include "lrtypes.h"
+
+struct textlayer;
+class PDFDoc;
+
+// The text layers and the word index of a document are saved in
+// ~/.cache/updf, in a file named after the document path, and mapped
+// back when it is opened again. Everything is in host byte order, a
+// file from another version is ignored and rewritten.
+
+#define STORE_MAGIC   "uPDFtxt"
+#define STORE_VERSION 2
+
+struct posting {
+  u32 page;
+  u32 word;
+};
+
+struct storeheader {
+  char magic[8];
+  u32  version;
+  u32  pages;
+  u64  stamp;       // Of the document size, mtime and inode
+  u64  dochash;     // Of the whole document content
+  u64  size;        // Of this file, a shorter one was truncated
+  u64  pagetab;     // storepage[pages]
+  u64  terms;       // storeterm[termcount], sorted by text
+  u64  strs;        // Term text
+  u64  postings;    // posting[]
+  u32  termcount;
+  u32  unused;
+};
+
+struct storepage {
+  u64 fingerprint;
+  u64 words;        // textword[count]
+  u64 text;
+  u32 count;
+  u32 lines;
+};
+
+struct storeterm {
+  u32 str;
+  u32 len;
+  u32 post;         // First posting
+  u32 count;
+};
+
+// Map the store of the current file. Returns NULL if there is none or
+// it can't be used; *exact tells if it was made from this very file,
+// going by its size, mtime and inode. store_verify() then compares the
+// content, off the way of the first pages.
+const storeheader *store_open(bool * const exact);
+bool store_verify();
+void store_close();
+
+// Identifies what a page draws: a hash of its content streams, images,
+// forms and size, never 0. page_fingerprint() uses the document of the
+// caller.
+u64 pdf_fingerprint(PDFDoc * const pdf, const u32 page);
+u64 page_fingerprint(const u32 page);
+
+// The stored layer of a page, or of any stored page with its
+// fingerprint, when pages were added or removed since. The layer points
+// into the mapping, only the struct is to be freed.
+textlayer *store_layer(const u32 page, const u64 fingerprint);
+
+// Same, without looking at the page, when the whole store is exact
+textlayer *store_exact_layer(const u32 page);
+
+// Replace the store of the current file. The terms must be sorted.
+void store_write(const textlayer * const * const layers,
+                 const u64 * const fingerprints,
+                 const storeterm * const terms, const u32 termcount,
+                 const char * const strs, const u32 strsize,
+                 const posting * const postings, const u32 postcount);
+
+#endif
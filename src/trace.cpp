@@ -0,0 +1,168 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "trace.h"
+#include <limits.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+struct traceevent {
+  u64 start, dur;   // ns since trace_start()
+  u32 arg;          // Usually the page
+  u8  what;
+};
+
+// Written by its thread only. The dump reads it while the thread may be
+// adding spans, so the oldest ones it sees can be torn, which is fine
+// for a diagnostic.
+struct tracering {
+  traceevent        events[TRACE_RING];
+  std::atomic<u32>  head;
+  s32               worker;   // Pool worker id, -1 outside of the pool
+  u32               tid;
+  tracering       * next;
+};
+
+static const char * const names[TR_COUNT] = {
+  "render", "margins", "compress", "decompress", "upload", "composite",
+  "draw", "open"
+};
+
+bool tracing = false;
+
+static char           * path  = NULL;
+static u64              epoch = 0;
+static pthread_mutex_t  lock  = PTHREAD_MUTEX_INITIALIZER;
+static tracering      * rings = NULL;
+static __thread tracering * mine = NULL;
+
+u64 trace_now() {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec - epoch;
+}
+
+// The ring of the calling thread, made on its first span
+static tracering *ring() {
+
+  if (!mine) {
+    tracering * const r = (tracering *) xcalloc(1, sizeof(tracering));
+    r->worker = threadpool::worker_id();
+    r->tid = syscall(SYS_gettid);
+
+    pthread_mutex_lock(&lock);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&lock);
+
+    mine = r;
+  }
+
+  return mine;
+}
+
+void trace_span_end(const u8 what, const u64 start, const u32 arg) {
+
+  const u64 end = trace_now();
+  tracering * const r = ring();
+
+  const u32 h = r->head.load(std::memory_order_relaxed);
+  traceevent * const e = &r->events[h & (TRACE_RING - 1)];
+
+  e->start = start;
+  e->dur   = end - start;
+  e->arg   = arg;
+  e->what  = what;
+
+  r->head.store(h + 1, std::memory_order_release);
+}
+
+void trace_start(const char *filename) {
+
+  path = strdup(filename);
+  epoch = 0;
+  epoch = trace_now();
+  tracing = true;
+}
+
+// Write all the rings as Chrome trace events, see chrome://tracing.
+// Only the threads of this process are there, not the worker processes.
+bool trace_dump() {
+
+  if (!path)
+    return false;
+
+  char tmp[PATH_MAX];
+  snprintf(tmp, PATH_MAX, "%s.tmp", path);
+
+  FILE * const f = fopen(tmp, "w");
+  if (!f) {
+    err(_("Can't write the trace to %s\n"), tmp);
+    return false;
+  }
+
+  const u32 pid = getpid();
+  bool first = true;
+
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+  pthread_mutex_lock(&lock);
+  tracering *r;
+  for (r = rings; r; r = r->next) {
+    char name[32];
+    if (r->worker < 0)
+      snprintf(name, 32, "%s", r->tid == pid ? "ui" : "other");
+    else
+      snprintf(name, 32, "render %d", r->worker);
+
+    fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %u, "
+      "\"tid\": %u, \"args\": {\"name\": \"%s\"}}", first ? "" : ",",
+      pid, r->tid, name);
+    first = false;
+
+    const u32 head = r->head.load(std::memory_order_acquire);
+    const u32 count = head < TRACE_RING ? head : TRACE_RING;
+
+    u32 i;
+    for (i = head - count; i != head; i++) {
+      const traceevent * const e = &r->events[i & (TRACE_RING - 1)];
+      if (e->what >= TR_COUNT)
+        continue;
+
+      fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %u, \"tid\": %u, "
+        "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"page\": %u}}",
+        names[e->what], pid, r->tid, e->start / 1000.0, e->dur / 1000.0,
+        e->arg + 1);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  fprintf(f, "\n]}\n");
+
+  if (fclose(f) || rename(tmp, path)) {
+    err(_("Can't write the trace to %s\n"), path);
+    unlink(tmp);
+    return false;
+  }
+
+  if (details)
+    printf(_("Trace written to %s\n"), path);
+
+  return true;
+}
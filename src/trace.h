@@ -0,0 +1,56 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "lrtypes.h"
+
+// Spans kept per thread, the oldest ones are overwritten. Must be a
+// power of two.
+#define TRACE_RING 16384
+
+enum trace_span {
+  TR_RENDER = 0,
+  TR_MARGINS,
+  TR_COMPRESS,
+  TR_DECOMPRESS,
+  TR_UPLOAD,
+  TR_COMPOSITE,
+  TR_DRAW,
+  TR_OPEN,
+  TR_COUNT
+};
+
+// Set once before any thread starts, when a trace file is given
+extern bool tracing;
+
+u64  trace_now();
+void trace_span_end(const u8 what, const u64 start, const u32 arg);
+void trace_start(const char *filename);
+bool trace_dump();
+
+// Usage: const u64 t = trace_begin(); ...; trace_end(TR_X, t, page);
+static inline u64 trace_begin() {
+  return tracing ? trace_now() : 0;
+}
+
+static inline void trace_end(const u8 what, const u64 start, const u32 arg) {
+  if (tracing)
+    trace_span_end(what, start, arg);
+}
+
+#endif
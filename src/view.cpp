@@ -24,11 +24,12 @@ as required by the user.
 */
 
 #include "view.h"
-#include <TextOutputDev.h>
-
-// Quarter inch in double resolution
-#define MARGIN 36
-#define MARGINHALF 18
+#include "textcache.h"
+#include "search.h"
+#include "wordgrid.h"
+#include "trace.h"
+#include "latency.h"
+#include "replay.h"
 
 PDFView::PDFView(int x, int y, int w, int h): Fl_Widget(x, y, w, h),
     view_zoom(0.5f),
@@ -41,7 +42,12 @@ PDFView::PDFView(int x, int y, int w, int h): Fl_Widget(x, y, w, h),
     yoff(0), xoff(0),
     selx(0), sely(0), selx2(0), sely2(0),
     columns(1), 
-    title_pages(0)
+    title_pages(0),
+    input_since(0),
+    hud_shown(false),
+    cache_hits(0), cache_misses(0),
+    last_frame(0),
+    hud_pending(0), hud_busy(0), hud_ready(0), hud_stored(0)
 {
   cachedsize = 7 * 1024 * 1024; // 7 megabytes
 
@@ -54,6 +60,9 @@ PDFView::PDFView(int x, int y, int w, int h): Fl_Widget(x, y, w, h),
     cachedpage[i] = USHRT_MAX;
     pix[i] = None;
   }
+
+  memset(hits, 0, sizeof(hits));
+  next_hits = 0;
 }
 
 // User requested trimming zone selection (or not if do_select is false).
@@ -233,6 +242,14 @@ void PDFView::goto_page(const float page)
   page_changed();
 }
 
+// Used by the replay, for the exact position of a recording
+void PDFView::set_offsets(const float x, const float y)
+{
+  xoff = x;
+  yoff = y;
+  page_changed();
+}
+
 void PDFView::set_columns(u32 count) 
 {
   if ((count >= 1) && (count <= 5)) {
@@ -268,6 +285,19 @@ void PDFView::new_file_loaded()
   clear_my_trim();
 }
 
+// The file changed on disk. Same place, but the pixmaps may be stale.
+void PDFView::reloaded()
+{
+  u32 i;
+  for (i = 0; i < CACHE_MAX; i++) {
+    cachedpage[i] = USHRT_MAX;
+  }
+
+  reset_selection();
+  adjust_yoff(0);
+  page_changed();
+}
+
 void PDFView::show_trim()
 {
   #if DEBUGGING
@@ -356,24 +386,24 @@ void PDFView::page_changed()
 
 const trim_struct * PDFView::get_trimming_for_page(s32 page) const
 {
-  single_page_trim_struct * curr = my_trim.singles;
-  const trim_struct * result;
-
-  while (curr && (curr->page < page)) curr = curr->next;
-
-  if (curr && (curr->page == page)) {
-    result = &curr->page_trim;
-  } 
-  else {
-    if (page & 1) {
-      result = &my_trim.even;
-    }
-    else {
-      result = &my_trim.odd;
-    }
-  }
+  return layout_trim(&my_trim, page);
+}
 
-  return result;
+// The page placement settings, for the layout functions
+layout PDFView::geometry() const
+{
+  layout l;
+
+  l.mode                = view_mode;
+  l.trim_zone_selection = trim_zone_selection;
+  l.my_trim             = &my_trim;
+  l.columns             = columns;
+  l.title_pages         = title_pages;
+  l.screen_width        = screen_width;
+  l.screen_height       = screen_height;
+  l.zoom                = view_zoom;
+
+  return l;
 }
 
 void PDFView::mode(view_mode_enum m)
@@ -387,171 +417,32 @@ void PDFView::mode(view_mode_enum m)
 
 u32 PDFView::pageh(u32 page) const 
 {
-  if (!file->cache[page].ready) page = 0;
-
-  s32 h;
-
-  if (view_mode == Z_TRIM || view_mode == Z_PGTRIM) {
-    h = file->cache[page].h;
-  }
-  else if (view_mode == Z_MYTRIM && !trim_zone_selection) {
-    if (my_trim.initialized) {
-      const trim_struct * the_trim = get_trimming_for_page(page);
-      h = the_trim->H;
-    }
-    else {
-      return file->cache[page].h;
-    }
-  }
-  else { // Z_PAGE || Z_WIDTH || Z_CUSTOM || (Z_MYTRIM && trim_zone_selection)
-    return  file->cache[page].h +
-        file->cache[page].top   +
-        file->cache[page].bottom;
-  }
-
-  return h < 2*MARGIN ? h + MARGIN : h;
+  const layout l = geometry();
+  return layout_pageh(&l, page);
 }
 
 u32 PDFView::pagew(u32 page) const 
 {
-  if (!file->cache[page].ready) page = 0;
-
-  if (view_mode == Z_TRIM || view_mode == Z_PGTRIM) {
-    return file->cache[page].w;
-  }
-  else if (view_mode == Z_MYTRIM && !trim_zone_selection) {
-    if (my_trim.initialized) {
-      const trim_struct * the_trim = get_trimming_for_page(page);
-      return  the_trim->W;
-    }
-    else {
-      return file->cache[page].w;
-    }
-  }
-  else { // Z_PAGE || Z_WIDTH || Z_CUSTOM || (Z_MYTRIM && trim_zone_selection)
-    return file->cache[page].w +
-        file->cache[page].left  +
-        file->cache[page].right;
-  }
+  const layout l = geometry();
+  return layout_pagew(&l, page);
 }
 
-// Compute the height of a line of pages, selecting the page that is the
-// largest in height.
 u32 PDFView::fullh(u32 page) const 
 {
-  if (!file->cache[page].ready) page = 0;
-
-  u32 fh = 0;
-  u32 h;
-  u32 i, limit;
-
-  if ((title_pages > 0) && (title_pages < columns) && (page < title_pages)) {
-    limit = title_pages;
-  }
-  else {
-    limit = page + columns;
-  }
-
-  if (limit > file->pages) limit = file->pages;
-
-  for (i = page; i < limit; i++) {
-    h = pageh(i);
-    if (h > fh) fh = h;
-  }
-  
-  // if (view_mode == Z_TRIM || view_mode == Z_PGTRIM || (view_mode == Z_MYTRIM && !trim_zone_selection))
-  //   for (i = page; i < limit; i++) {
-  //     if (file->cache[i].ready && (file->cache[i].h > fh))
-  //       fh = file->cache[i].h;
-  //   }
-  // else 
-  //   for (i = page; i < limit; i++) {
-  //     if (file->cache[i].ready) {
-  //       u32 h = file->cache[i].h +
-  //           file->cache[i].top   +
-  //           file->cache[i].bottom;
-  //       if (h > fh)
-  //         fh = h;
-  //     }
-  //   }               
-
-  return fh;
+  const layout l = geometry();
+  return layout_fullh(&l, page);
 }
 
-// Compute the width of a line of pages. The page number is the one that is
-// the first on the left of the line.
 u32 PDFView::fullw(u32 page) const 
 {
-  u32 fw = 0;
-  u32 i, limit;
-
-  if ((title_pages > 0) && (title_pages < columns) && (page < title_pages)) {
-    limit = title_pages;
-  }
-  else {
-    limit = page + columns;
-  }
-
-  if (limit > file->pages) limit = file->pages;
-
-  for (i = page; i < (page + columns); i++) {
-    fw += pagew(i < limit ? i : 0);
-  }
-  
-  // Add the margins between columns
-  return fw + (columns - 1) * MARGINHALF;
-}
-
-static bool hasmargins(const u32 page) 
-{
-  if (!file->cache[page].ready) {
-    return
-      file->cache[0].left   > MARGIN ||
-      file->cache[0].right  > MARGIN ||
-      file->cache[0].top    > MARGIN ||
-      file->cache[0].bottom > MARGIN;
-  }
-
-  return
-    file->cache[page].left   > MARGIN ||
-    file->cache[page].right  > MARGIN ||
-    file->cache[page].top    > MARGIN ||
-    file->cache[page].bottom > MARGIN;
+  const layout l = geometry();
+  return layout_fullw(&l, page);
 }
 
-// Compute the required zoom factor to fit the line of pages on the screen,
-// according to the zoom mode parameter if not a custom zoom.
 float PDFView::line_zoom_factor(const u32 first_page, u32 &width, u32 &height) const 
 {
-  const u32 line_width  = fullw(first_page);
-  const u32 line_height = fullh(first_page);
-
-  float zoom_factor;
-
-  switch (view_mode) {
-    case Z_TRIM:
-    case Z_WIDTH:
-      zoom_factor = (float)screen_width / line_width;
-      break;
-    case Z_PAGE:
-    case Z_PGTRIM:
-    case Z_MYTRIM:
-      if (((float)line_width / line_height) > ((float)screen_width / screen_height)) {
-        zoom_factor = (float)screen_width / line_width;
-      }
-      else {
-        zoom_factor = (float)screen_height / line_height;
-      }
-      break;
-    default:
-      zoom_factor = view_zoom;
-      break;
-  }
-
-  width  = line_width;
-  height = line_height;
-
-  return zoom_factor;
+  const layout l = geometry();
+  return layout_zoom(&l, first_page, width, height);
 }
 
 void PDFView::update_visible() const 
@@ -571,8 +462,6 @@ void PDFView::update_visible() const
   // Those are very very conservative numbers to compute last_visible. 
   // The end of the draw process will adjust precisely the value
 
-  static const u32 max_lines_per_screen[MAX_COLUMNS_COUNT] = { 2, 3, 4, 5, 6 };
-
   // Adjust file->first_visible
 
   file->first_visible = yoff < 0 ? 0 : yoff;
@@ -582,23 +471,21 @@ void PDFView::update_visible() const
 
   // Adjust file->last_visible
 
-  u32 new_last_visible = file->first_visible + max_lines_per_screen[columns - 1] * columns;
+  const u32 new_last_visible = layout_lastvisible(file->first_visible, columns);
   if (new_last_visible >= file->pages) {
     file->last_visible = file->pages - 1;
   }
   else {
     file->last_visible = new_last_visible;
   }
+
+  render_visible(file->first_visible, file->last_visible);
 }
 
-// Compute the vertical screen size of a line of pages
-u32 PDFView::pxrel(u32 page) const 
+u32 PDFView::pxrel(u32 page) const
 {
-  float zoom;
-  u32 line_width, line_height;
-  
-  zoom = line_zoom_factor(page, line_width, line_height);
-  return line_height * zoom;
+  const layout l = geometry();
+  return layout_pxrel(&l, page);
 }
 
 void PDFView::draw() 
@@ -618,14 +505,21 @@ void PDFView::draw()
   if (W == 0 || H == 0)
     return;
 
+  const u64 span = trace_begin();
+  const u64 start = latency_now();
+
   fl_overlay_clear();
 
   // Paint the background with the page separation color
   fl_rectf(X, Y, W, H, FL_GRAY + 1);
 
-  struct cachedpage *cur = &file->cache[file->first_visible];
+  if (!page_ready(file->first_visible)) {
+    trace_end(TR_DRAW, span, file->first_visible);
+    frame_done(start);
+    return;
+  }
 
-  if (!cur->ready) return;
+  struct cachedpage *cur;
 
   // insure that nothing will be drawned outside the clipped area
   fl_push_clip(X, Y, W, H);
@@ -692,9 +586,9 @@ void PDFView::draw()
     // Do the following for each page in the line
     while ((column < limit) && (page < file->pages)) {
 
-      cur = &file->cache[page];
-      if (!cur->ready)
+      if (!page_ready(page))
         break;
+      cur = &file->cache[page];
 
       H = pageh(page) * zoom;
       W = pagew(page) * zoom;
@@ -711,7 +605,7 @@ void PDFView::draw()
         }
       #endif
 
-      const bool margins = hasmargins(page);
+      const bool margins = layout_hasmargins(page);
       const bool trimmed = 
         (margins && ((view_mode == Z_TRIM) || (view_mode == Z_PGTRIM)));
 
@@ -788,7 +682,21 @@ void PDFView::draw()
         }
       #endif
 
-      content(page, X, Y, W, H);
+      page_pos_struct pos;
+      pos.page    = page;
+      pos.X0      = Xs;
+      pos.Y0      = Ys;
+      pos.W0      = Ws;
+      pos.H0      = Hs;
+      pos.X       = X;
+      pos.Y       = Y;
+      pos.W       = W;
+      pos.H       = H;
+      pos.zoom    = zoom;
+      pos.ratio_x = ratio_x;
+      pos.ratio_y = ratio_y;
+
+      content(&pos);
 
       if (view_mode == Z_MYTRIM && 
           !trim_zone_selection && 
@@ -822,22 +730,7 @@ void PDFView::draw()
       // a selection is made to retrieve the text underneath
       if (page_pos_count < PAGES_ON_SCREEN_MAX) {
 
-        pp->page    = page;
-        pp->X0      = Xs;
-        pp->Y0      = Ys; 
-        pp->W0      = Ws;
-        pp->H0      = Hs;              
-        pp->X       = X;
-        pp->Y       = Y;
-        pp->W       = W;
-        pp->H       = H;
-        pp->zoom    = zoom;
-        pp->ratio_x = ratio_x;
-        pp->ratio_y = ratio_y;
-
-        // if (page_pos_count == 0) 
-        //  printf("Copy X0:%d Y0:%d X:%d Y:%d W:%d H:%d Zoom: %6.3f page: %d\n", 
-        //      pp->X0, pp->Y0, pp->X, pp->Y, pp->W, pp->H, pp->zoom, pp->page + 1);
+        *pp = pos;
 
         page_pos_count++;
         pp++;
@@ -867,7 +760,102 @@ void PDFView::draw()
 
   file->last_visible = page;
 
+  // Have the text ready for when the selection ends
+  if (text_selection)
+    text_prefetch(file->first_visible, file->last_visible);
+
   fl_pop_clip();
+
+  if (hud_shown)
+    draw_hud();
+
+  trace_end(TR_DRAW, span, file->first_visible);
+  frame_done(start);
+  startup_drawn();
+}
+
+// While the pool works, pages render off screen: look at the counters
+// twice a second, and only redraw if one moved
+static void cb_hud(void * v)
+{
+  PDFView * const view = (PDFView *) v;
+
+  if (view->hud_changed())
+    view->redraw();
+
+  if (pool->pending() || pool->busy())
+    Fl::repeat_timeout(HUD_POLL, cb_hud, v);
+}
+
+void PDFView::toggle_hud()
+{
+  hud_shown = !hud_shown;
+
+  if (!hud_shown)
+    Fl::remove_timeout(cb_hud, this);
+
+  redraw();
+}
+
+// The frame time and the pixmap cache only change with a frame, they
+// don't call for one
+bool PDFView::hud_changed() const
+{
+  return hud_shown && (pool->pending() != hud_pending ||
+                       pool->busy() != hud_busy ||
+                       file->ready.load(std::memory_order_relaxed) != hud_ready ||
+                       file->stored.load(std::memory_order_relaxed) != hud_stored);
+}
+
+// Diagnostics overlay, in the top left corner of the view
+void PDFView::draw_hud()
+{
+  hud_pending = pool->pending();
+  hud_busy    = pool->busy();
+  hud_ready   = file->ready.load(std::memory_order_relaxed);
+  hud_stored  = file->stored.load(std::memory_order_relaxed);
+
+  if ((hud_pending || hud_busy) && !Fl::has_timeout(cb_hud, this))
+    Fl::add_timeout(HUD_POLL, cb_hud, this);
+
+  const u32 lookups = cache_hits + cache_misses;
+  u32 i;
+
+  char lines[6][80];
+  snprintf(lines[0], 80, _("Render queue: %u tasks"), hud_pending);
+  snprintf(lines[1], 80, _("Threads busy: %u / %u"), hud_busy, pool->threads());
+  snprintf(lines[2], 80, _("Pages ready: %u / %u"), hud_ready, file->pages);
+  snprintf(lines[3], 80, _("Compressed store: %.2f MB"), hud_stored / 1048576.0f);
+  snprintf(lines[4], 80, _("Pixmap cache hits: %.1f%% of %u"),
+           lookups ? 100.0f * cache_hits / lookups : 0.0f, lookups);
+  snprintf(lines[5], 80, _("Last frame: %.2f ms"), last_frame / 1000.0f);
+
+  fl_font(FL_HELVETICA, 12);
+  const int lh = fl_height();
+  const int hx = screen_x + 8, hy = screen_y + 8;
+  const int hw = 240, hh = 6 * lh + 8;
+
+  fl_push_clip(hx, hy, hw, hh);
+  fl_rectf(hx, hy, hw, hh, fl_rgb_color(32, 32, 32));
+  fl_color(FL_WHITE);
+  for (i = 0; i < 6; i++)
+    fl_draw(lines[i], hx + 6, hy + 4 + (i + 1) * lh - fl_descent());
+  fl_pop_clip();
+}
+
+// Account for a frame, and for the input it shows. The X server may
+// still be compositing it.
+void PDFView::frame_done(const u64 start)
+{
+  const u64 end = latency_now();
+
+  last_frame = end - start;
+  latency_record(LAT_FRAME, view_mode, columns, last_frame);
+
+  if (input_since) {
+    latency_record(LAT_INPUT, view_mode, columns, end - input_since);
+    input_since = 0;
+  }
 }
 
 // Compute the maximum yoff value, taking care of the number of 
@@ -885,44 +873,8 @@ void PDFView::draw()
 // last = 12 - (12 % 4) - (columns - title_pages) = 12 - 0 - 3 = 9 
 float PDFView::maxyoff() const 
 {
-  float zoom, f;
-  u32   line_width, line_height, h;
-
-  s32 pages = file->pages;
-  s32 last  = pages - 1;
-  last     -= (last % columns);
-  if ((title_pages > 0) && (title_pages < columns)) {
-    last -= (columns - title_pages);
-    if (last < (pages - (s32)columns)) {
-      last += columns;
-    }
-  }
-
-  if (last < 0) last = 0;
-
-  if (!file->cache[last].ready)
-    f = last + 0.5f;
-  else {
-    s32 H = screen_height;
-
-    while (true) {
-      zoom = line_zoom_factor(last, line_width, line_height);
-      H   -= (h = zoom * (line_height + MARGINHALF));
-
-      if (H <= 0) {
-        H += (MARGINHALF * zoom);
-        f = last + (float)(-H) / (zoom * line_height);
-        break;
-      } 
-
-      last -= columns;
-      if (last < 0) {
-        f = 0.0f;
-        break;
-      }
-    }
-  }
-  return f;
+  const layout l = geometry();
+  return layout_maxyoff(&l);
 }
 
 // Advance the yoff position by an offset, taking into account the number
@@ -1041,6 +993,142 @@ void PDFView::select_page_at(s32 X, s32 Y, bool right_dclick)
   goto_page(pp->page);
 }
 
+// Search for the page caracteristics saved before with
+// the draw method.
+const page_pos_struct * PDFView::page_pos_at(const s32 X, const s32 Y) const
+{
+  u32 idx;
+  const page_pos_struct *pp = page_pos_on_screen;
+
+  for (idx = 0; idx < page_pos_count; idx++, pp++) {
+    if ((X >= pp->X0)         &&
+        (Y >= pp->Y0)         &&
+        (X < (pp->X + pp->W)) &&
+        (Y < (pp->Y + pp->H))) {
+      return pp;
+    }
+  }
+
+  return NULL;
+}
+
+// Select the word, or the line, under the mouse and copy it to the
+// clipboard. False if there is no word there.
+bool PDFView::pick_text(const s32 X, const s32 Y, const bool line)
+{
+  const page_pos_struct * const pp = page_pos_at(X, Y);
+  if (!pp)
+    return false;
+
+  float px, py, box[4];
+  screen_to_page(pp, X, Y, &px, &py);
+
+  char * const str = line ? line_at(pp->page, px, py, box) :
+                            word_at(pp->page, px, py, box);
+  if (!str)
+    return false;
+
+  Fl::copy(str, strlen(str), 1);
+  free(str);
+
+  XRectangle r;
+  if (page_to_screen(pp, box, 1, &r)) {
+    selx  = r.x < 0 ? 0 : r.x;
+    sely  = r.y < 0 ? 0 : r.y;
+    selx2 = r.x + r.width;
+    sely2 = r.y + r.height;
+  }
+
+  redraw();
+  return true;
+}
+
+// The page content is offset by its trimmed margins in the trim modes
+bool PDFView::trimmed_coords() const
+{
+  return view_mode == Z_TRIM   ||
+         view_mode == Z_PGTRIM ||
+        (view_mode == Z_MYTRIM && !trim_zone_selection);
+}
+
+// Screen position to original page resolution, with the geometry the
+// page was drawn with
+void PDFView::screen_to_page(
+  const page_pos_struct * const pp,
+  const s32 X,
+  const s32 Y,
+  float * const px,
+  float * const py) const
+{
+  float x, y;
+
+  if (trimmed_coords()) {
+    x = X - pp->X0 + (pp->zoom * file->cache[pp->page].left);
+    y = Y - pp->Y0 + (pp->zoom * file->cache[pp->page].top );
+
+    if (layout_hasmargins(pp->page)) {
+      x -= (pp->X - pp->X0);
+      y -= (pp->Y - pp->Y0);
+    }
+  }
+  else {
+    x = X - pp->X0;
+    y = Y - pp->Y0;
+  }
+
+  *px = x / (pp->zoom * pp->ratio_x);
+  *py = y / (pp->zoom * pp->ratio_y);
+}
+
+// The reverse of screen_to_page(), for a whole batch of boxes given as
+// x0, y0, x1, y1 quadruples. Returns the number of rectangles made.
+u32 PDFView::page_to_screen(
+  const page_pos_struct * const pp,
+  const float * const boxes,
+  const u32 count,
+  XRectangle * const rects) const
+{
+  const float zx = pp->zoom * pp->ratio_x;
+  const float zy = pp->zoom * pp->ratio_y;
+  float ox, oy;
+
+  if (trimmed_coords()) {
+    ox = pp->X0 - (pp->zoom * file->cache[pp->page].left);
+    oy = pp->Y0 - (pp->zoom * file->cache[pp->page].top );
+
+    if (layout_hasmargins(pp->page)) {
+      ox += (pp->X - pp->X0);
+      oy += (pp->Y - pp->Y0);
+    }
+  }
+  else {
+    ox = pp->X0;
+    oy = pp->Y0;
+  }
+
+  // X rectangles are 16 bits, drop what is far out of the window
+  u32 i, kept = 0;
+  for (i = 0; i < count; i++) {
+    const float * const b = boxes + i * 4;
+    const float x0 = ox + b[0] * zx;
+    const float y0 = oy + b[1] * zy;
+    const float x1 = ox + b[2] * zx + 1;
+    const float y1 = oy + b[3] * zy + 1;
+
+    if (x1 < 0 || y1 < 0 || x0 > SHRT_MAX || y0 > SHRT_MAX ||
+        x1 - x0 > USHRT_MAX || y1 - y0 > USHRT_MAX)
+      continue;
+
+    rects[kept].x      = x0 < SHRT_MIN ? SHRT_MIN : x0;
+    rects[kept].y      = y0 < SHRT_MIN ? SHRT_MIN : y0;
+    rects[kept].width  = x1 - rects[kept].x;
+    rects[kept].height = y1 - rects[kept].y;
+    kept++;
+  }
+
+  return kept;
+}
+
 void PDFView::end_of_selection() 
 {
   s32 X, Y, W, H;
@@ -1062,22 +1150,8 @@ void PDFView::end_of_selection()
     H = sely - Y;
   }
 
-  // Search for the page caracteristics saved before with
-  // the draw method.
-  u32 idx = 0;
-  page_pos_struct *pp = page_pos_on_screen;
-
-  while (idx < page_pos_count) {
-    if ((X >= pp->X0)         &&
-        (Y >= pp->Y0)         &&
-        (X < (pp->X + pp->W)) &&
-        (Y < (pp->Y + pp->H))) {
-      break;
-    }
-    idx++;
-    pp++;
-  }
-  if (idx >= page_pos_count) {
+  const page_pos_struct * const pp = page_pos_at(X, Y);
+  if (!pp) {
     redraw();
     return; // Not found
   }
@@ -1126,40 +1200,32 @@ void PDFView::end_of_selection()
     }
   }
 
-  // Convert to page coords
-  if (view_mode == Z_TRIM   || 
-      view_mode == Z_PGTRIM || 
-     (view_mode == Z_MYTRIM && !trim_zone_selection)) {
-    X = X - pp->X0 + (pp->zoom * file->cache[pp->page].left);
-    Y = Y - pp->Y0 + (pp->zoom * file->cache[pp->page].top ) ;
-
-    if (hasmargins(pp->page)) {
-      X -= (pp->X - pp->X0);
-      Y -= (pp->Y - pp->Y0);
-    }
-  }
-  else {
-    X -= pp->X0;
-    Y -= pp->Y0;
-  }
-
   // Convert to original page resolution
-  X /= (pp->zoom * pp->ratio_x);
-  Y /= (pp->zoom * pp->ratio_y);
+  float px, py;
+  screen_to_page(pp, X, Y, &px, &py);
+  X = px;
+  Y = py;
   W /= (pp->zoom * pp->ratio_x);
   H /= (pp->zoom * pp->ratio_y);
 
   if (text_selection) {
-    TextOutputDev * const dev = new TextOutputDev(NULL, true, 0, false, false);
-    file->pdf->displayPage(dev, pp->page + 1, 144, 144, 0, true, false, false);
-    GooString *str = dev->getText(X, Y, X + W, Y + H);
-    const char * const cstr = str->getCString();
+    const textlayer * const layer = page_ready(pp->page) ?
+                                    file->cache[pp->page].text : NULL;
 
-    // Put it to clipboard
-    Fl::copy(cstr, strlen(cstr), 1);
+    if (layer) {
+      char * const cstr = textlayer_get(layer, X, Y, X + W, Y + H);
+      Fl::copy(cstr, strlen(cstr), 1);
+      free(cstr);
+    }
+    else {
+      GooString *str = text_get(pp->page, X, Y, X + W, Y + H);
+      const char * const cstr = str->getCString();
 
-    delete str;
-    delete dev;
+      // Put it to clipboard
+      Fl::copy(cstr, strlen(cstr), 1);
+
+      delete str;
+    }
   }
   else if (trim_zone_selection) {
     if (single_page_trim) {
@@ -1236,7 +1302,32 @@ trim_zone_loc_enum PDFView::get_trim_zone_loc(s32 x, s32 y) const
 	else                                           return TZL_NONE;
 }
 
-int PDFView::handle(int e) 
+int PDFView::handle(int e)
+{
+  const u64 now = latency_now();
+
+  if (recording)
+    record_event(e, this);
+
+  const int ret = handle_event(e);
+
+  // The oldest input waiting for a frame starts the latency
+  switch (e) {
+    case FL_PUSH:
+    case FL_DRAG:
+    case FL_RELEASE:
+    case FL_MOUSEWHEEL:
+    case FL_KEYDOWN:
+    case FL_SHORTCUT:
+      if (!input_since && damage())
+        input_since = now;
+    break;
+  }
+
+  return ret;
+}
+
+int PDFView::handle_event(int e) 
 {
   static trim_zone_loc_enum trim_zone_loc = TZL_NONE;
   
@@ -1290,7 +1381,10 @@ int PDFView::handle(int e)
       if (Fl::event_button() == FL_LEFT_MOUSE) {
         some_drag = false;
         if (Fl::event_clicks()) {
-          select_page_at(lastx, lasty, Fl::event_ctrl());
+          // Double-click picks a word, triple-click its line
+          if (!text_selection ||
+              !pick_text(lastx, lasty, Fl::event_clicks() > 1))
+            select_page_at(lastx, lasty, Fl::event_ctrl());
         } 
         else {
           if (text_selection) {
@@ -1504,7 +1598,7 @@ int PDFView::handle(int e)
             u32 page = yoff;
             s32 sh = line_height * zoom;
 
-            if (file->cache[page].ready) {
+            if (page_ready(page)) {
               const s32 hidden = sh - screen_height;
               float tmp = floorf(yoff) + hidden / (float) sh;
               if (tmp > yoff)
@@ -1521,6 +1615,14 @@ int PDFView::handle(int e)
         case FL_F + 8:
           cb_hide_show_buttons(NULL, NULL); // Hide toolbar
           break;
+
+        case FL_F + 9:
+          latency_print(stderr);
+          break;
+
+        case FL_F + 10:
+          toggle_hud();
+          break;
           
         default:
           return 0;
@@ -1540,7 +1642,14 @@ int PDFView::handle(int e)
         fl_cursor(FL_CURSOR_WAIT);
       }
       else if (text_selection) {
-        fl_cursor(FL_CURSOR_CROSS);
+        const page_pos_struct * const pp = page_pos_at(Fl::event_x(), Fl::event_y());
+        float px, py;
+
+        if (pp)
+          screen_to_page(pp, Fl::event_x(), Fl::event_y(), &px, &py);
+
+        fl_cursor(pp && over_word(pp->page, px, py) ?
+                  FL_CURSOR_INSERT : FL_CURSOR_CROSS);
       }
       else if (trim_zone_selection) {
         trim_zone_loc = get_trim_zone_loc(Fl::event_x(), Fl::event_y());
@@ -1584,6 +1693,9 @@ void PDFView::docache(const u32 page)
   const struct cachedpage * const cur = &file->cache[page];
   u32 i;
 
+  // Be safe
+  if (!page_ready(page)) return;
+
   if (cur->uncompressed > cachedsize) {
     cachedsize = cur->uncompressed;
 
@@ -1592,11 +1704,10 @@ void PDFView::docache(const u32 page)
     }
   }
 
-  // Be safe
-  if (!cur->ready) return;
-
   const u32 dst = rand() % CACHE_MAX;
 
+  u64 span = trace_begin();
+
   lzo_uint dstsize = cachedsize;
   const int ret = lzo1x_decompress(cur->data,
           cur->size,
@@ -1609,6 +1720,9 @@ void PDFView::docache(const u32 page)
 
   cachedpage[dst] = page;
 
+  trace_end(TR_DECOMPRESS, span, page);
+  span = trace_begin();
+
   // Create the Pixmap
   if (pix[dst] != None) {
     XFreePixmap(fl_display, pix[dst]);
@@ -1630,23 +1744,33 @@ void PDFView::docache(const u32 page)
 
   xi->data = NULL;
   XDestroyImage(xi);
+
+  // Until the X server is done with it, this only covers sending it
+  trace_end(TR_UPLOAD, span, page);
 }
 
-void PDFView::content(
-  const u32 page, 
-  const s32 X, 
-  const s32 Y,
-  const u32 W, 
-  const u32 H) 
+void PDFView::content(const page_pos_struct * const pos)
 {
+  const u32 page = pos->page;
+  const s32 X = pos->X, Y = pos->Y;
+  const u32 W = pos->W, H = pos->H;
+
   // Do a gpu-accelerated bilinear blit
   u8 c = iscached(page);
-  if (c == UCHAR_MAX) docache(page);
+  if (c == UCHAR_MAX) {
+    docache(page);
+    cache_misses++;
+  }
+  else {
+    cache_hits++;
+  }
 
   c = iscached(page);
 
   const struct cachedpage * const cur = &file->cache[page];
 
+  const u64 span = trace_begin();
+
   XRenderPictureAttributes srcattr;
   memset(&srcattr, 0, sizeof(XRenderPictureAttributes));
   XRenderPictFormat *fmt = XRenderFindStandardFormat(fl_display, PictStandardRGB24);
@@ -1672,6 +1796,64 @@ void PDFView::content(
 //  XCopyArea(fl_display, pix[c], fl_window, fl_gc, 0, 0, W, H, X, Y);
 //  fl_draw_image(cache[c], X, Y, W, H, 4, file->cache[page].w * 4);
 
+  highlight(dst, pos);
+
+  XRenderFreePicture(fl_display, src);
+  XRenderFreePicture(fl_display, dst);
+
+  trace_end(TR_COMPOSITE, span, page);
+}
+
+// The search hits of a page, from the last time it was drawn unless
+// the search changed since
+const hit_boxes_struct * PDFView::hit_boxes(const u32 page)
+{
+  const u32 generation = search_generation();
+  hit_boxes_struct *slot = NULL;
+
+  u32 i;
+  for (i = 0; i < PAGES_ON_SCREEN_MAX; i++) {
+    if (hits[i].generation && hits[i].page == page) {
+      slot = &hits[i];
+      break;
+    }
+  }
+
+  if (slot && slot->generation == generation)
+    return slot;
+
+  // The oldest one goes, there are never more pages on screen
+  if (!slot) {
+    slot = &hits[next_hits];
+    next_hits = (next_hits + 1) % PAGES_ON_SCREEN_MAX;
+  }
+
+  free(slot->boxes);
+  slot->page = page;
+  slot->generation = generation;
+  slot->count = search_boxes(page, &slot->boxes);
+
+  return slot;
+}
+
+// Draw the search hits and the text selection over a page, one request
+// per kind, or per HIGHLIGHT_MAX hits
+void PDFView::highlight(const Picture dst, const page_pos_struct * const pos)
+{
+  const hit_boxes_struct * const hb = hit_boxes(pos->page);
+  XRectangle rects[HIGHLIGHT_MAX];
+
+  u32 done;
+  for (done = 0; done < hb->count; done += HIGHLIGHT_MAX) {
+    const u32 batch = hb->count - done < HIGHLIGHT_MAX ? hb->count - done :
+                      HIGHLIGHT_MAX;
+    const u32 count = page_to_screen(pos, hb->boxes + done * 4, batch, rects);
+    if (count) {
+      const XRenderColor hitcol = {24576, 24576, 0, 24576};
+      XRenderFillRectangles(fl_display, PictOpOver, dst, &hitcol, rects, count);
+    }
+  }
+
   if (text_selection && selx2 && sely2 && selx != selx2 && sely != sely2) {
     // Draw a selection rectangle over this area
     const XRenderColor col = {0, 0, 16384, 16384};
@@ -1697,7 +1879,4 @@ void PDFView::content(
 
     XRenderFillRectangle(fl_display, PictOpOver, dst, &col, x, y, w, h);
   }
-
-  XRenderFreePicture(fl_display, src);
-  XRenderFreePicture(fl_display, dst);
 }
@@ -27,10 +27,25 @@ Modifications Copyright (C) 2016 Guy Turcotte
 #define VIEW_H
 
 #include "main.h"
+#include "layout.h"
 
 #define CACHE_MAX 15
 #define PAGES_ON_SCREEN_MAX 50
 
+// Seconds between looks at the overlay counters, while rendering
+#define HUD_POLL 0.5
+
+// Highlighted boxes sent to the X server per request
+#define HIGHLIGHT_MAX 512
+
+// Search hits of a page, as given by search_boxes()
+struct hit_boxes_struct {
+  u32     page;
+  u32     generation;   // 0 for an unused slot
+  u32     count;
+  float * boxes;
+};
+
 // Used to keep drawing postion of displayed pages to
 // help in the identification of the selection zone.
 // Used by the end_of_selection method.
@@ -69,23 +84,33 @@ public:
   void set_title_page_count(u32 count);
   void set_params(recent_file_struct &recent);
   void new_file_loaded();
+  void reloaded();
   void page_up();
   void page_down();
   void page_top();
   void page_bottom();
+  void toggle_hud();
+  bool hud_changed() const;
 
   void mode(view_mode_enum m);
-  inline float zoom() { return view_zoom; };
+  inline float zoom() const { return view_zoom; };
   inline void  zoom(float zoom) { view_zoom = zoom > 0.1f ? (zoom < 10.0f ? zoom : 10.0f) : 0.1f; };
-  inline view_mode_enum  mode() { return view_mode; };
-  inline float get_xoff() { return xoff; };
-  inline float get_yoff() { return yoff; };
-  inline u32   get_columns() { return columns; };
-  inline u32   get_title_page_count() { return title_pages; };
+  inline view_mode_enum  mode() const { return view_mode; };
+  inline float get_xoff() const { return xoff; };
+  inline float get_yoff() const { return yoff; };
+  inline u32   get_columns() const { return columns; };
+  inline u32   get_title_page_count() const { return title_pages; };
+  inline u32   get_cache_hits() const { return cache_hits; };
+  inline u32   get_cache_misses() const { return cache_misses; };
+  inline void  reset_cache_stats() { cache_hits = cache_misses = 0; };
+  void  set_offsets(const float x, const float y);
   inline my_trim_struct & get_my_trim() { return my_trim; };
   inline bool is_single_page_trim() { return single_page_trim; };
 
 private:
+  int   handle_event(int e);
+  void  frame_done(const u64 start);
+  void  draw_hud();
   void  reset_selection(bool anyway = false);
   void  select_page_at(s32 X, s32 Y, bool right_dclick);
   void  page_changed();
@@ -97,10 +122,19 @@ private:
   void  docache(const u32 page);
   float maxyoff() const;
   u32   pxrel(u32 page) const;
-  void  content(const u32 page, const s32 X, const s32 y, const u32 w, const u32 h);
+  void  content(const page_pos_struct * const pos);
+  void  highlight(const Picture dst, const page_pos_struct * const pos);
+  const hit_boxes_struct * hit_boxes(const u32 page);
   void  adjust_yoff(float offset);
   void  adjust_floor_yoff(float offset);
   void  end_of_selection();
+  const page_pos_struct * page_pos_at(const s32 X, const s32 Y) const;
+  bool  pick_text(const s32 X, const s32 Y, const bool line);
+  bool  trimmed_coords() const;
+  void  screen_to_page(const page_pos_struct * const pp, const s32 X, const s32 Y,
+                       float * const px, float * const py) const;
+  u32   page_to_screen(const page_pos_struct * const pp, const float * const boxes,
+                       const u32 count, XRectangle * const rects) const;
   void  add_single_page_trim(s32 page, s32 X, s32 Y, s32 W, s32 H);
   void  remove_single_page_trim(s32 page);
   trim_zone_loc_enum get_trim_zone_loc(s32 x, s32 y) const;
@@ -110,6 +144,7 @@ private:
   u32   pagew(u32 page) const;
   u32   fullh(u32 page) const;
   u32   fullw(u32 page) const;
+  layout geometry() const;
 
   float  view_zoom;
   u32    left_dclick_columns_count, right_dclick_columns_count;
@@ -127,12 +162,27 @@ private:
   page_pos_struct page_pos_on_screen[PAGES_ON_SCREEN_MAX];
   u32    page_pos_count;
 
+  // For the pages on screen, asked again only when the search changes
+  hit_boxes_struct hits[PAGES_ON_SCREEN_MAX];
+  u32    next_hits;
+
   // Text selection coords
   u16 selx, sely, selx2, sely2, savedx, savedy;
   u32 columns, title_pages;
 
   s32 screen_x, screen_y, screen_width, screen_height;
   my_trim_struct my_trim;
+
+  u64    input_since;   // Input not shown yet, 0 if none
+
+  // Diagnostics overlay, F10
+  bool   hud_shown;
+  u32    cache_hits, cache_misses;
+  u32    last_frame;    // us
+
+  // What the overlay showed last of what changes between frames
+  u32    hud_pending, hud_busy, hud_ready;
+  u64    hud_stored;
 };
 
 #endif
@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "watch.h"
+#include <sys/inotify.h>
+
+static int    fd   = -1;
+static int    wd   = -1;
+static char * name = NULL;
+
+int watch_init() {
+
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    die(_("Failed in inotify_init1()\n"));
+
+  return fd;
+}
+
+void watch_file(const char *filename) {
+
+  if (fd < 0)
+    return;
+
+  if (wd >= 0)
+    inotify_rm_watch(fd, wd);
+  free(name);
+
+  const char * const slash = strrchr(filename, '/');
+  name = strdup(slash ? slash + 1 : filename);
+
+  char *dir;
+  if (!slash)
+    dir = strdup(".");
+  else if (slash == filename)
+    dir = strdup("/");
+  else
+    dir = strndup(filename, slash - filename);
+
+  wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd < 0)
+    err(_("Can't watch %s for changes\n"), dir);
+
+  free(dir);
+}
+
+bool watch_changed() {
+
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  ssize_t len;
+
+  while ((len = read(fd, buf, sizeof(buf))) > 0) {
+    const char *p = buf;
+    while (p < buf + len) {
+      const struct inotify_event * const e = (const struct inotify_event *) p;
+
+      if (e->wd == wd && e->len && !strcmp(e->name, name))
+        changed = true;
+
+      p += sizeof(struct inotify_event) + e->len;
+    }
+  }
+
+  return changed;
+}
@@ -0,0 +1,35 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+// Tells when the opened file was written again, with inotify.
+//
+// The directory is watched rather than the file, as builds often write
+// a new file and rename it over the old one.
+
+// Returns the descriptor the UI has to watch
+int  watch_init();
+
+// Follow this file from now on, in place of the previous one
+void watch_file(const char *filename);
+
+// Called by the UI when the descriptor is readable. True if the file
+// was written or replaced.
+bool watch_changed();
+
+#endif
@@ -0,0 +1,242 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "core.h"
+#include "wordgrid.h"
+#include "textcache.h"
+#include "search.h"
+#include <float.h>
+#include <math.h>
+
+struct wordgrid {
+  u32               doc;
+  u32               page;
+  const textlayer * layer;
+  textlayer       * own;
+  u32               cols, rows;
+  float             cellw, cellh;
+  u32             * cells;   // First item of each cell, cols * rows + 1
+  u32             * items;   // Word numbers
+  u64               used;
+};
+
+static wordgrid grids[WORD_GRID_MAX];
+static u64      stamp = 0;
+
+static void drop(wordgrid * const g) {
+
+  free(g->own);
+  free(g->cells);
+  free(g->items);
+  memset(g, 0, sizeof(wordgrid));
+}
+
+static u32 cell(const float v, const float size, const u32 count) {
+
+  const s32 c = v / size;
+  if (c < 0)
+    return 0;
+  return (u32) c >= count ? count - 1 : c;
+}
+
+// Bucket the words by the cells their box covers
+static void build(wordgrid * const g) {
+
+  const textlayer * const layer = g->layer;
+  float maxx = 1, maxy = 1;
+  u32 i, x, y;
+
+  for (i = 0; i < layer->count; i++) {
+    if (layer->words[i].x1 > maxx) maxx = layer->words[i].x1;
+    if (layer->words[i].y1 > maxy) maxy = layer->words[i].y1;
+  }
+
+  u32 side = sqrtf(layer->count / (float) WORD_GRID_FILL);
+  if (side < 1) side = 1;
+  if (side > 64) side = 64;
+
+  g->cols = g->rows = side;
+  g->cellw = maxx / side;
+  g->cellh = maxy / side;
+  g->cells = (u32 *) xcalloc(side * side + 1, sizeof(u32));
+
+  // Count, then place
+  for (i = 0; i < layer->count; i++) {
+    const textword * const w = &layer->words[i];
+    const u32 x0 = cell(w->x0, g->cellw, side), x1 = cell(w->x1, g->cellw, side);
+    const u32 y0 = cell(w->y0, g->cellh, side), y1 = cell(w->y1, g->cellh, side);
+    for (y = y0; y <= y1; y++)
+      for (x = x0; x <= x1; x++)
+        g->cells[y * side + x + 1]++;
+  }
+  for (i = 0; i < side * side; i++)
+    g->cells[i + 1] += g->cells[i];
+
+  u32 * const fill = (u32 *) xmalloc(side * side * sizeof(u32));
+  memcpy(fill, g->cells, side * side * sizeof(u32));
+  g->items = (u32 *) xmalloc((g->cells[side * side] + 1) * sizeof(u32));
+
+  for (i = 0; i < layer->count; i++) {
+    const textword * const w = &layer->words[i];
+    const u32 x0 = cell(w->x0, g->cellw, side), x1 = cell(w->x1, g->cellw, side);
+    const u32 y0 = cell(w->y0, g->cellh, side), y1 = cell(w->y1, g->cellh, side);
+    for (y = y0; y <= y1; y++)
+      for (x = x0; x <= x1; x++)
+        g->items[fill[y * side + x]++] = i;
+  }
+
+  free(fill);
+}
+
+static const textlayer *source(const u32 page, textlayer ** const own) {
+
+  *own = NULL;
+  if (page_ready(page) && file->cache[page].text)
+    return file->cache[page].text;
+
+  const textlayer * const layer = search_layer(page, own);
+  if (layer)
+    return layer;
+
+  return *own = text_cache_layer(page);
+}
+
+static wordgrid *grid(const u32 page) {
+
+  const u32 doc = file->doc;
+  wordgrid *victim = &grids[0];
+  u32 i;
+
+  for (i = 0; i < WORD_GRID_MAX; i++) {
+    wordgrid * const g = &grids[i];
+    if (g->doc == doc && g->page == page) {
+      g->used = ++stamp;
+      return g;
+    }
+    if (g->used < victim->used)
+      victim = g;
+  }
+
+  textlayer *own;
+  const textlayer * const layer = source(page, &own);
+  if (!layer)
+    return NULL;
+
+  drop(victim);
+  victim->doc = doc;
+  victim->page = page;
+  victim->layer = layer;
+  victim->own = own;
+  victim->used = ++stamp;
+  build(victim);
+
+  return victim;
+}
+
+// Number of the word at the point, -1 if none
+static s32 find(const wordgrid * const g, const float x, const float y) {
+
+  if (x < 0 || y < 0)
+    return -1;
+
+  const u32 c = cell(y, g->cellh, g->rows) * g->cols + cell(x, g->cellw, g->cols);
+  u32 i;
+
+  for (i = g->cells[c]; i < g->cells[c + 1]; i++) {
+    const textword * const w = &g->layer->words[g->items[i]];
+    if (x >= w->x0 && x <= w->x1 && y >= w->y0 && y <= w->y1)
+      return g->items[i];
+  }
+
+  return -1;
+}
+
+bool over_word(const u32 page, const float x, const float y) {
+
+  const wordgrid * const g = grid(page);
+  return g && find(g, x, y) >= 0;
+}
+
+// Text and box of the words first to last, on one line
+static char *span(const textlayer * const layer, const u32 first, const u32 last,
+                  float * const box) {
+
+  u32 i, bytes = 1;
+  for (i = first; i <= last; i++)
+    bytes += layer->words[i].len + 1;
+
+  char * const out = (char *) xmalloc(bytes);
+  char *cur = out;
+
+  box[0] = box[1] = FLT_MAX;
+  box[2] = box[3] = -FLT_MAX;
+
+  for (i = first; i <= last; i++) {
+    const textword * const w = &layer->words[i];
+
+    if (i > first)
+      *cur++ = ' ';
+    memcpy(cur, layer->text + w->text, w->len);
+    cur += w->len;
+
+    if (w->x0 < box[0]) box[0] = w->x0;
+    if (w->y0 < box[1]) box[1] = w->y0;
+    if (w->x1 > box[2]) box[2] = w->x1;
+    if (w->y1 > box[3]) box[3] = w->y1;
+  }
+  *cur = '\0';
+
+  return out;
+}
+
+char *word_at(const u32 page, const float x, const float y, float * const box) {
+
+  const wordgrid * const g = grid(page);
+  const s32 word = g ? find(g, x, y) : -1;
+
+  if (word < 0)
+    return NULL;
+
+  return span(g->layer, word, word, box);
+}
+
+char *line_at(const u32 page, const float x, const float y, float * const box) {
+
+  const wordgrid * const g = grid(page);
+  const s32 word = g ? find(g, x, y) : -1;
+
+  if (word < 0)
+    return NULL;
+
+  // Lines are numbered in reading order, their words follow each other
+  const textword * const words = g->layer->words;
+  const u16 line = words[word].line;
+  u32 first = word, last = word;
+
+  while (first && words[first - 1].line == line)
+    first--;
+  while (last + 1 < g->layer->count && words[last + 1].line == line)
+    last++;
+
+  return span(g->layer, first, last, box);
+}
+
+void wordgrid_clear() {
+
+  u32 i;
+  for (i = 0; i < WORD_GRID_MAX; i++)
+    drop(&grids[i]);
+}
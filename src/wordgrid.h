@@ -0,0 +1,44 @@
+/*
+Copyright (C) 2016 Guy Turcotte
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WORDGRID_H
+#define WORDGRID_H
+
+#include "lrtypes.h"
+
+// Pages whose word grid is kept
+#define WORD_GRID_MAX 8
+
+// Words per grid cell aimed at
+#define WORD_GRID_FILL 2
+
+// Finding words under the mouse. The word boxes of a page are bucketed in
+// a uniform grid, built from text already extracted: the text layer, the
+// search index or the selection text cache. Pages with none of those
+// have no words yet. UI thread only.
+
+// Is there a word at this point, in 144 dpi page coordinates
+bool over_word(const u32 page, const float x, const float y);
+
+// Text of the word at this point, or of its whole line, NULL if there is
+// none. Its box is stored as x0, y0, x1, y1. The caller frees the text.
+char *word_at(const u32 page, const float x, const float y, float * const box);
+char *line_at(const u32 page, const float x, const float y, float * const box);
+
+// Forget the grids, before the text they point to goes away
+void wordgrid_clear();
+
+#endif